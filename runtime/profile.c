@@ -0,0 +1,126 @@
+// Runtime for code compiled with kopic -fprofile-generate. At exit, it writes
+// the counters of the instrumented code to a raw profile, for llvm-profdata
+// merge to turn into the .profdata file that -fprofile-use reads.
+//
+// This is a small stand-in for compiler-rt's profile runtime, which has to be
+// used instead when linking with clang -fprofile-generate. It only supports
+// what kopic generates: one process writing one file, without value profiles.
+//
+// The profile goes to the file given to -fprofile-generate=<file>, or to
+// $LLVM_PROFILE_FILE, or else to default.profraw in the working directory.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <llvm/ProfileData/InstrProfData.inc>
+
+enum ValueKind {
+#define VALUE_PROF_KIND(Enumerator, Value, Descr) Enumerator = Value,
+#include <llvm/ProfileData/InstrProfData.inc>
+};
+
+// Per-function data as laid out by the instrumentation, only its size matters
+// here since the records are copied to the profile as they are
+typedef void *IntPtrT;
+typedef struct __attribute__((aligned(8))) {
+#define INSTR_PROF_DATA(Type, LLVMType, Name, Initializer) Type Name;
+#include <llvm/ProfileData/InstrProfData.inc>
+} ProfileData;
+
+typedef struct {
+#define INSTR_PROF_RAW_HEADER(Type, Name, Initializer) Type Name;
+#include <llvm/ProfileData/InstrProfData.inc>
+} RawHeader;
+
+// Referenced by every instrumented module, so that linking them pulls in the
+// runtime
+int INSTR_PROF_PROFILE_RUNTIME_VAR;
+
+// Defined by the instrumented modules, the file name only with
+// -fprofile-generate=<file>
+extern const uint64_t INSTR_PROF_RAW_VERSION_VAR;
+extern const char INSTR_PROF_PROFILE_NAME_VAR[] __attribute__((weak));
+
+// The linker defines these for the sections the instrumented modules put their
+// per-function data, counters and names in
+#define SECTION_BOUNDS(name)                                                                                           \
+    extern char __start_##name[] __attribute__((weak, visibility("hidden")));                                         \
+    extern char __stop_##name[] __attribute__((weak, visibility("hidden")))
+SECTION_BOUNDS(__llvm_prf_data);
+SECTION_BOUNDS(__llvm_prf_cnts);
+SECTION_BOUNDS(__llvm_prf_bits);
+SECTION_BOUNDS(__llvm_prf_names);
+
+static uint64_t __llvm_profile_get_magic(void) {
+    return INSTR_PROF_RAW_MAGIC_64;
+}
+
+static uint64_t __llvm_profile_get_version(void) {
+    return INSTR_PROF_RAW_VERSION_VAR;
+}
+
+// Binary IDs are optional, and none are written
+static int __llvm_write_binary_ids(void *writer) {
+    (void)writer;
+    return 0;
+}
+
+static uint64_t paddingFor(uint64_t size) {
+    return (8 - size % 8) % 8;
+}
+
+static void writeProfile(void) {
+    const char *DataBegin = __start___llvm_prf_data, *DataEnd = __stop___llvm_prf_data;
+    const char *CountersBegin = __start___llvm_prf_cnts, *CountersEnd = __stop___llvm_prf_cnts;
+    const char *BitmapBegin = __start___llvm_prf_bits, *BitmapEnd = __stop___llvm_prf_bits;
+    const char *NamesBegin = __start___llvm_prf_names, *NamesEnd = __stop___llvm_prf_names;
+    if (DataBegin == DataEnd)
+        return;
+    if (BitmapBegin == NULL) {
+        BitmapBegin = BitmapEnd = CountersEnd;
+    }
+
+    // The header counts data records and counters rather than bytes, both
+    // are 8 byte aligned so none of the sections before the names need
+    // padding
+    uint64_t dataBytes = DataEnd - DataBegin, counterBytes = CountersEnd - CountersBegin;
+    uint64_t NumData = dataBytes / sizeof(ProfileData);
+    uint64_t NumCounters = counterBytes / sizeof(uint64_t);
+    uint64_t NumBitmapBytes = BitmapEnd - BitmapBegin;
+    uint64_t NamesSize = NamesEnd - NamesBegin;
+    uint64_t PaddingBytesBeforeCounters = 0, PaddingBytesAfterCounters = 0;
+    uint64_t PaddingBytesAfterBitmapBytes = paddingFor(NumBitmapBytes);
+
+    RawHeader header = {
+#define INSTR_PROF_RAW_HEADER(Type, Name, Initializer) .Name = (Initializer),
+#include <llvm/ProfileData/InstrProfData.inc>
+    };
+
+    const char *filename = getenv("LLVM_PROFILE_FILE");
+    if (filename == NULL || *filename == '\0') {
+        filename = INSTR_PROF_PROFILE_NAME_VAR != NULL && *INSTR_PROF_PROFILE_NAME_VAR != '\0'
+                       ? INSTR_PROF_PROFILE_NAME_VAR
+                       : "default.profraw";
+    }
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "kopi profile: unable to open %s\n", filename);
+        return;
+    }
+
+    static const char zeros[8];
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(DataBegin, 1, dataBytes, file) == dataBytes;
+    ok = ok && fwrite(CountersBegin, 1, counterBytes, file) == counterBytes;
+    ok = ok && fwrite(BitmapBegin, 1, NumBitmapBytes, file) == NumBitmapBytes;
+    ok = ok && fwrite(zeros, 1, PaddingBytesAfterBitmapBytes, file) == PaddingBytesAfterBitmapBytes;
+    ok = ok && fwrite(NamesBegin, 1, NamesSize, file) == NamesSize;
+    ok = ok && fwrite(zeros, 1, paddingFor(NamesSize), file) == paddingFor(NamesSize);
+    if (fclose(file) != 0 || !ok) {
+        fprintf(stderr, "kopi profile: unable to write %s\n", filename);
+    }
+}
+
+__attribute__((constructor)) static void registerProfileWriter(void) {
+    atexit(writeProfile);
+}
@@ -2,84 +2,156 @@
 
 #include <iostream>
 
-void ASTNode::dbgprint(int indent) const {
+llvm::ArrayRef<AnnotationName> funcAnnotationNames() {
+    static const AnnotationName names[] = {
+        {"TailCall", AnnotateTailCall, 0, false},
+        {"Hot", AnnotateHot, AnnotateCold, false},
+        {"Cold", AnnotateCold, AnnotateHot, false},
+        {"Inline", AnnotateInline, AnnotateNoInline, false},
+        {"NoInline", AnnotateNoInline, AnnotateInline, false},
+    };
+    return names;
+}
+
+llvm::ArrayRef<AnnotationName> loopAnnotationNames() {
+    static const AnnotationName names[] = {
+        {"Unroll", AnnotateUnroll, AnnotateNoUnroll, true},
+        {"NoUnroll", AnnotateNoUnroll, AnnotateUnroll, false},
+        {"Vectorize", AnnotateVectorize, AnnotateNoVectorize, true},
+        {"NoVectorize", AnnotateNoVectorize, AnnotateVectorize, false},
+    };
+    return names;
+}
+
+void ASTNode::dbgprint(const SourceBuffer &src, int indent) const {
     for (int i = 0; i < indent; i++)
         std::cout << '\t';
 }
 
-void NumericExprASTNode::dbgprint(int indent) const {
-    ASTNode::dbgprint(indent);
-    std::cout << "<expr_num> " << number.contents << std::endl;
+void NumericExprASTNode::dbgprint(const SourceBuffer &src, int indent) const {
+    ASTNode::dbgprint(src, indent);
+    std::cout << "<expr_num> " << value << std::endl;
 }
 
-void IdentifierExprASTNode::dbgprint(int indent) const {
-    ASTNode::dbgprint(indent);
-    std::cout << "<expr_ident> " << identifier.contents << std::endl;
+void IdentifierExprASTNode::dbgprint(const SourceBuffer &src, int indent) const {
+    ASTNode::dbgprint(src, indent);
+    std::cout << "<expr_ident> " << src.text(identifier) << std::endl;
 }
 
-void FuncCallExprASTNode::dbgprint(int indent) const {
-    ASTNode::dbgprint(indent);
-    std::cout << "<expr_call> " << function.contents << std::endl;
+void FuncCallExprASTNode::dbgprint(const SourceBuffer &src, int indent) const {
+    ASTNode::dbgprint(src, indent);
+    std::cout << "<expr_call> " << src.text(function) << std::endl;
     for (const auto &arg : arguments) {
-        arg->dbgprint(indent + 1);
+        arg->dbgprint(src, indent + 1);
     }
 }
 
-void UnaryOpExprASTNode::dbgprint(int indent) const {
-    ASTNode::dbgprint(indent);
-    std::cout << "<expr_unop> " << op.contents << '\n';
-    operand->dbgprint(indent + 1);
+void UnaryOpExprASTNode::dbgprint(const SourceBuffer &src, int indent) const {
+    ASTNode::dbgprint(src, indent);
+    std::cout << "<expr_unop> " << src.text(op) << '\n';
+    operand->dbgprint(src, indent + 1);
 }
 
-void BinaryOpExprASTNode::dbgprint(int indent) const {
-    ASTNode::dbgprint(indent);
-    std::cout << "<expr_binop> " << op.contents << '\n';
-    left->dbgprint(indent + 1);
-    right->dbgprint(indent + 1);
+void BinaryOpExprASTNode::dbgprint(const SourceBuffer &src, int indent) const {
+    // The operators of the chain from the outermost in, then the innermost
+    // left operand, and the right operands from the innermost out
+    auto chain = leftChain(this);
+    for (size_t i = 0; i < chain.size(); i++) {
+        chain[i]->ASTNode::dbgprint(src, indent + i);
+        std::cout << "<expr_binop> " << src.text(chain[i]->op) << '\n';
+    }
+    chain.back()->left->dbgprint(src, indent + chain.size());
+    for (size_t i = chain.size(); i-- > 0;) {
+        chain[i]->right->dbgprint(src, indent + i + 1);
+    }
 }
 
-void ReturnStmtASTNode::dbgprint(int indent) const {
-    ASTNode::dbgprint(indent);
+void ReturnStmtASTNode::dbgprint(const SourceBuffer &src, int indent) const {
+    ASTNode::dbgprint(src, indent);
     std::cout << "<stmt_ret>" << '\n';
-    expr->dbgprint(indent + 1);
+    expr->dbgprint(src, indent + 1);
 }
 
-void VariableDeclStmtASTNode::dbgprint(int indent) const {
-    ASTNode::dbgprint(indent);
-    std::cout << "<stmt_vardecl> " << identifier.contents << '\n';
+void VariableDeclStmtASTNode::dbgprint(const SourceBuffer &src, int indent) const {
+    ASTNode::dbgprint(src, indent);
+    std::cout << "<stmt_vardecl> " << src.text(identifier) << '\n';
     if (initExpr) {
-        initExpr->dbgprint(indent + 1);
+        initExpr->dbgprint(src, indent + 1);
     }
 }
 
-void AssignmentStmtASTNode::dbgprint(int indent) const {
-    ASTNode::dbgprint(indent);
-    std::cout << "<stmt_assign> " << identifier.contents << '\n';
-    expression->dbgprint(indent + 1);
+void AssignmentStmtASTNode::dbgprint(const SourceBuffer &src, int indent) const {
+    ASTNode::dbgprint(src, indent);
+    std::cout << "<stmt_assign> " << src.text(identifier) << '\n';
+    expression->dbgprint(src, indent + 1);
 }
 
-void CompoundStmtASTNode::dbgprint(int indent) const {
-    ASTNode::dbgprint(indent);
+void CompoundStmtASTNode::dbgprint(const SourceBuffer &src, int indent) const {
+    ASTNode::dbgprint(src, indent);
     std::cout << "<stmt_block>" << '\n';
     for (auto &&stmt : stmts) {
-        stmt->dbgprint(indent + 1);
+        stmt->dbgprint(src, indent + 1);
+    }
+}
+
+void IfStmtASTNode::dbgprint(const SourceBuffer &src, int indent) const {
+    ASTNode::dbgprint(src, indent);
+    std::cout << "<stmt_if>" << '\n';
+    condition->dbgprint(src, indent + 1);
+    thenStmt->dbgprint(src, indent + 1);
+    if (elseStmt) {
+        elseStmt->dbgprint(src, indent + 1);
     }
 }
 
-void FuncASTNode::dbgprint(int indent) const {
-    ASTNode::dbgprint(indent);
-    std::cout << "<func> " << identifier.contents;
+void LoopStmtASTNode::dbgprint(const SourceBuffer &src, int indent) const {
+    ASTNode::dbgprint(src, indent);
+    std::cout << "<stmt_loop>";
+    for (const AnnotationName &annotation : loopAnnotationNames()) {
+        if (hints.annotations & annotation.annotation) {
+            std::cout << " @" << annotation.name;
+            uint32_t count = annotation.annotation == AnnotateUnroll      ? hints.unrollCount
+                             : annotation.annotation == AnnotateVectorize ? hints.vectorizeWidth
+                                                                          : 0;
+            if (count != 0) {
+                std::cout << '(' << count << ')';
+            }
+        }
+    }
+    std::cout << '\n';
+    if (init) {
+        init->dbgprint(src, indent + 1);
+    }
+    if (condition) {
+        condition->dbgprint(src, indent + 1);
+    }
+    if (step) {
+        step->dbgprint(src, indent + 1);
+    }
+    body->dbgprint(src, indent + 1);
+}
+
+void FuncASTNode::dbgprint(const SourceBuffer &src, int indent) const {
+    ASTNode::dbgprint(src, indent);
+    static const char *const visibilityNames[] = {"private", "protected", "public"};
+    std::cout << "<func>";
+    for (const AnnotationName &annotation : funcAnnotationNames()) {
+        if (annotations & annotation.annotation) {
+            std::cout << " @" << annotation.name;
+        }
+    }
+    std::cout << ' ' << visibilityNames[static_cast<int>(vis)] << ' ' << src.text(identifier);
     for (const auto &param : params) {
-        std::cout << ' ' << param.contents;
+        std::cout << ' ' << src.text(param);
     }
     std::cout << '\n';
-    body->dbgprint(indent + 1);
+    body->dbgprint(src, indent + 1);
 }
 
-void SourceFileASTNode::dbgprint(int indent) const {
-    ASTNode::dbgprint(indent);
+void SourceFileASTNode::dbgprint(const SourceBuffer &src, int indent) const {
+    ASTNode::dbgprint(src, indent);
     std::cout << "<file>\n";
     for (const auto &func : functions) {
-        func->dbgprint(indent + 1);
+        func->dbgprint(src, indent + 1);
     }
 }
@@ -1,33 +1,100 @@
 #pragma once
 
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Function.h>
 #include <llvm/IR/Value.h>
+#include <llvm/Support/Allocator.h>
 
 #include <memory>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <utility>
-#include <vector>
 
 #include "token.hpp"
 
+class CodegenContext;
+class BinaryOpExprASTNode;
+class ConstEvaluator;
+class FuncCallExprASTNode;
+
+// Owns every AST node of one compilation. Nodes are bump allocated and never
+// destroyed individually, the whole tree is released at once with the arena.
+class ASTArena {
+  public:
+    template <typename T, typename... Args> T *make(Args &&...args) {
+        static_assert(std::is_trivially_destructible_v<T>, "AST nodes are never destroyed");
+        numNodes++;
+        return new (allocator.Allocate<T>()) T(std::forward<Args>(args)...);
+    }
+
+    // Copies a list of children into the arena
+    template <typename T> llvm::MutableArrayRef<T> copy(llvm::ArrayRef<T> items) {
+        static_assert(std::is_trivially_copyable_v<T>, "AST nodes are never destroyed");
+        T *data = allocator.Allocate<T>(items.size());
+        std::uninitialized_copy(items.begin(), items.end(), data);
+        return llvm::MutableArrayRef<T>(data, items.size());
+    }
+
+    size_t nodeCount() const {
+        return numNodes;
+    }
+    size_t bytesAllocated() const {
+        return allocator.getBytesAllocated();
+    }
+
+  private:
+    llvm::BumpPtrAllocator allocator;
+    size_t numNodes = 0;
+};
+
+// Nodes have no virtual destructor on purpose, they are only ever freed along
+// with their ASTArena.
 class ASTNode {
   public:
-    virtual ~ASTNode() = default;
-    virtual llvm::Value *emit() const = 0;
-    virtual void dbgprint(int indent = 0) const;
+    virtual llvm::Value *emit(CodegenContext &ctx) const = 0;
+    virtual void dbgprint(const SourceBuffer &src, int indent = 0) const;
 };
 
-class ExprASTNode : public ASTNode {};
+class ExprASTNode : public ASTNode {
+  public:
+    // Folds constant subexpressions, returns the node that replaces this one
+    virtual ExprASTNode *fold(ConstEvaluator &eval) = 0;
+    // Computes the value from the variables of the function being evaluated,
+    // returns false if it can't be known at compile time
+    virtual bool evaluate(ConstEvaluator &eval, int32_t *value) const = 0;
+    // Only literals have a constant value once folding is done
+    virtual bool constantValue(int32_t *value) const {
+        return false;
+    }
+    // The expression as a function call, if that's what it is
+    virtual const FuncCallExprASTNode *asCall() const {
+        return nullptr;
+    }
+    virtual BinaryOpExprASTNode *asBinaryOp() {
+        return nullptr;
+    }
+    // Emits the expression as an i1 to branch on, any value but 0 is true
+    virtual llvm::Value *emitCondition(CodegenContext &ctx) const;
+};
 
 class NumericExprASTNode : public ExprASTNode {
   public:
-    explicit NumericExprASTNode(Token number) : number(number) {
+    NumericExprASTNode(Token number, int32_t value) : number(number), value(value) {
     }
 
-    llvm::Value *emit() const override;
-    void dbgprint(int indent) const override;
+    ExprASTNode *fold(ConstEvaluator &eval) override;
+    bool evaluate(ConstEvaluator &eval, int32_t *value) const override;
+    bool constantValue(int32_t *value) const override;
+    llvm::Value *emit(CodegenContext &ctx) const override;
+    void dbgprint(const SourceBuffer &src, int indent) const override;
 
   private:
+    // The literal, or the operator of an expression that was folded into it
     Token number;
+    int32_t value;
 };
 
 class IdentifierExprASTNode : public ExprASTNode {
@@ -35,8 +102,10 @@ class IdentifierExprASTNode : public ExprASTNode {
     explicit IdentifierExprASTNode(Token ident) : identifier(ident) {
     }
 
-    llvm::Value *emit() const override;
-    void dbgprint(int indent) const override;
+    ExprASTNode *fold(ConstEvaluator &eval) override;
+    bool evaluate(ConstEvaluator &eval, int32_t *value) const override;
+    llvm::Value *emit(CodegenContext &ctx) const override;
+    void dbgprint(const SourceBuffer &src, int indent) const override;
 
   private:
     Token identifier;
@@ -44,130 +113,289 @@ class IdentifierExprASTNode : public ExprASTNode {
 
 class FuncCallExprASTNode : public ExprASTNode {
   public:
-    FuncCallExprASTNode(Token function, std::vector<std::unique_ptr<ExprASTNode>> arguments)
-        : function(function), arguments(std::move(arguments)) {
+    FuncCallExprASTNode(Token function, llvm::MutableArrayRef<ExprASTNode *> arguments)
+        : function(function), arguments(arguments) {
     }
 
-    llvm::Value *emit() const override;
-    void dbgprint(int indent) const override;
+    ExprASTNode *fold(ConstEvaluator &eval) override;
+    bool evaluate(ConstEvaluator &eval, int32_t *value) const override;
+    const FuncCallExprASTNode *asCall() const override {
+        return this;
+    }
+    llvm::Value *emit(CodegenContext &ctx) const override;
+    // Emits the call of a return statement, as a tail call where possible
+    llvm::Value *emitTailCall(CodegenContext &ctx) const;
+    void dbgprint(const SourceBuffer &src, int indent) const override;
 
   private:
     Token function;
-    std::vector<std::unique_ptr<ExprASTNode>> arguments;
+    llvm::MutableArrayRef<ExprASTNode *> arguments;
 };
 
 class UnaryOpExprASTNode : public ExprASTNode {
   public:
-    UnaryOpExprASTNode(Token op, std::unique_ptr<ExprASTNode> expr) : op(op), operand(std::move(expr)) {
+    UnaryOpExprASTNode(Token op, ExprASTNode *expr) : op(op), operand(expr) {
     }
 
-    llvm::Value *emit() const override;
-    void dbgprint(int indent) const override;
+    ExprASTNode *fold(ConstEvaluator &eval) override;
+    bool evaluate(ConstEvaluator &eval, int32_t *value) const override;
+    llvm::Value *emit(CodegenContext &ctx) const override;
+    void dbgprint(const SourceBuffer &src, int indent) const override;
 
   private:
     Token op;
-    std::unique_ptr<ExprASTNode> operand;
+    ExprASTNode *operand;
 };
 
 class BinaryOpExprASTNode : public ExprASTNode {
   public:
-    BinaryOpExprASTNode(Token op, std::unique_ptr<ExprASTNode> l, std::unique_ptr<ExprASTNode> r)
-        : op(op), left(std::move(l)), right(std::move(r)) {
+    BinaryOpExprASTNode(Token op, ExprASTNode *l, ExprASTNode *r) : op(op), left(l), right(r) {
     }
 
-    llvm::Value *emit() const override;
-    void dbgprint(int indent) const override;
+    ExprASTNode *fold(ConstEvaluator &eval) override;
+    bool evaluate(ConstEvaluator &eval, int32_t *value) const override;
+    llvm::Value *emit(CodegenContext &ctx) const override;
+    llvm::Value *emitCondition(CodegenContext &ctx) const override;
+    void dbgprint(const SourceBuffer &src, int indent) const override;
+    BinaryOpExprASTNode *asBinaryOp() override {
+        return this;
+    }
 
   private:
+    // Operators chained on the left, like a + b + c + d, make a tree as deep
+    // as the chain is long, far deeper than the parser lets anything else
+    // nest. Every pass walks them in a loop instead of recursively, over the
+    // operations from the node down its left operands, which this returns.
+    template <typename Node> static llvm::SmallVector<Node *, 8> leftChain(Node *node) {
+        llvm::SmallVector<Node *, 8> chain = {node};
+        while (BinaryOpExprASTNode *next = chain.back()->left->asBinaryOp()) {
+            chain.push_back(next);
+        }
+        return chain;
+    }
+
+    // Folds the right operand and the operation, once the left one is folded
+    ExprASTNode *foldOperation(ConstEvaluator &eval);
+    // Emit the right operand and the operation, given the left operand
+    llvm::Value *emitOperation(CodegenContext &ctx, llvm::Value *l) const;
+    llvm::Value *emitComparison(CodegenContext &ctx, llvm::Value *l) const;
+
     Token op;
-    std::unique_ptr<ExprASTNode> left;
-    std::unique_ptr<ExprASTNode> right;
+    ExprASTNode *left;
+    ExprASTNode *right;
 };
 
-class StmtASTNode : public ASTNode {};
+class StmtASTNode : public ASTNode {
+  public:
+    virtual void fold(ConstEvaluator &eval) = 0;
+    // Interprets the statement, returns false if it can't be done at compile time
+    virtual bool execute(ConstEvaluator &eval) const = 0;
+};
 
 class ReturnStmtASTNode : public StmtASTNode {
   public:
-    explicit ReturnStmtASTNode(std::unique_ptr<ExprASTNode> &expr) : expr(std::move(expr)) {
+    explicit ReturnStmtASTNode(ExprASTNode *expr) : expr(expr) {
     }
 
-    llvm::Value *emit() const override;
-    void dbgprint(int indent) const override;
+    void fold(ConstEvaluator &eval) override;
+    bool execute(ConstEvaluator &eval) const override;
+    llvm::Value *emit(CodegenContext &ctx) const override;
+    void dbgprint(const SourceBuffer &src, int indent) const override;
 
   private:
-    std::unique_ptr<ExprASTNode> expr;
+    ExprASTNode *expr;
 };
 
 class VariableDeclStmtASTNode : public StmtASTNode {
   public:
-    VariableDeclStmtASTNode(Token ident, std::unique_ptr<ExprASTNode> init)
-        : identifier(ident), initExpr(std::move(init)) {
+    VariableDeclStmtASTNode(Token ident, ExprASTNode *init) : identifier(ident), initExpr(init) {
     }
 
-    llvm::Value *emit() const override;
-    void dbgprint(int indent) const override;
+    void fold(ConstEvaluator &eval) override;
+    bool execute(ConstEvaluator &eval) const override;
+    llvm::Value *emit(CodegenContext &ctx) const override;
+    void dbgprint(const SourceBuffer &src, int indent) const override;
 
   private:
     Token identifier;
-    std::unique_ptr<ExprASTNode> initExpr;
+    ExprASTNode *initExpr;
 };
 
 class AssignmentStmtASTNode : public StmtASTNode {
   public:
-    AssignmentStmtASTNode(Token ident, std::unique_ptr<ExprASTNode> expr)
-        : identifier(ident), expression(std::move(expr)) {
+    AssignmentStmtASTNode(Token ident, ExprASTNode *expr) : identifier(ident), expression(expr) {
     }
 
-    llvm::Value *emit() const override;
-    void dbgprint(int indent) const override;
+    void fold(ConstEvaluator &eval) override;
+    bool execute(ConstEvaluator &eval) const override;
+    llvm::Value *emit(CodegenContext &ctx) const override;
+    void dbgprint(const SourceBuffer &src, int indent) const override;
 
   private:
     Token identifier;
-    std::unique_ptr<ExprASTNode> expression;
+    ExprASTNode *expression;
 };
 
 class CompoundStmtASTNode : public StmtASTNode {
   public:
-    explicit CompoundStmtASTNode(std::vector<std::unique_ptr<StmtASTNode>> list) : stmts(std::move(list)) {
+    explicit CompoundStmtASTNode(llvm::ArrayRef<StmtASTNode *> list) : stmts(list) {
     }
 
-    llvm::Value *emit() const override;
-    void dbgprint(int indent) const override;
+    void fold(ConstEvaluator &eval) override;
+    bool execute(ConstEvaluator &eval) const override;
+    llvm::Value *emit(CodegenContext &ctx) const override;
+    void dbgprint(const SourceBuffer &src, int indent) const override;
 
   private:
-    std::vector<std::unique_ptr<StmtASTNode>> stmts;
+    llvm::ArrayRef<StmtASTNode *> stmts;
+};
+
+class IfStmtASTNode : public StmtASTNode {
+  public:
+    IfStmtASTNode(ExprASTNode *cond, StmtASTNode *then, StmtASTNode *otherwise)
+        : condition(cond), thenStmt(then), elseStmt(otherwise) {
+    }
+
+    void fold(ConstEvaluator &eval) override;
+    bool execute(ConstEvaluator &eval) const override;
+    llvm::Value *emit(CodegenContext &ctx) const override;
+    void dbgprint(const SourceBuffer &src, int indent) const override;
+
+  private:
+    ExprASTNode *condition;
+    StmtASTNode *thenStmt;
+    // Null without an else branch
+    StmtASTNode *elseStmt;
+};
+
+// How an annotation is written after the @, and what it stands for
+struct AnnotationName {
+    std::string_view name;
+    uint32_t annotation;
+    // The annotations it contradicts, which can't be used along with it
+    uint32_t conflicts;
+    // Whether a count in brackets can follow the name
+    bool takesCount;
+};
+
+// Annotations that can be put on a loop, as a set of flags. They are only
+// hints to the optimizer, which leaves loops alone at -O0.
+enum LoopAnnotation : uint32_t {
+    // Unroll the loop, by the count in brackets if there is one
+    AnnotateUnroll = 1 << 0,
+    AnnotateNoUnroll = 1 << 1,
+    // Vectorize the loop, as wide as the count in brackets if there is one
+    AnnotateVectorize = 1 << 2,
+    AnnotateNoVectorize = 1 << 3,
+};
+
+// Every loop annotation
+llvm::ArrayRef<AnnotationName> loopAnnotationNames();
+
+struct LoopHints {
+    uint32_t annotations = 0;
+    // The counts of @Unroll and @Vectorize, 0 leaves them to the optimizer
+    uint32_t unrollCount = 0;
+    uint32_t vectorizeWidth = 0;
+};
+
+// Both while and for loops, a while loop is a for loop without the
+// initialization and the step
+class LoopStmtASTNode : public StmtASTNode {
+  public:
+    LoopStmtASTNode(LoopHints hints, StmtASTNode *init, ExprASTNode *cond, StmtASTNode *step, StmtASTNode *body)
+        : hints(hints), init(init), condition(cond), step(step), body(body) {
+    }
+
+    void fold(ConstEvaluator &eval) override;
+    bool execute(ConstEvaluator &eval) const override;
+    llvm::Value *emit(CodegenContext &ctx) const override;
+    void dbgprint(const SourceBuffer &src, int indent) const override;
+
+  private:
+    LoopHints hints;
+    // Any of the parts in the brackets of a for loop can be left out, and
+    // are null then. Without a condition the loop only ends by returning.
+    StmtASTNode *init;
+    ExprASTNode *condition;
+    StmtASTNode *step;
+    StmtASTNode *body;
 };
 
 enum class Visibility { Private, Protected, Public };
 
+// Annotations that can be put on a function, as a set of flags
+enum FuncAnnotation : uint32_t {
+    // Every call in a return statement has to be a tail call
+    AnnotateTailCall = 1 << 0,
+    // Optimize the function as one that runs often, or rarely
+    AnnotateHot = 1 << 1,
+    AnnotateCold = 1 << 2,
+    // Inline every call to the function where possible, or none
+    AnnotateInline = 1 << 3,
+    AnnotateNoInline = 1 << 4,
+};
+
+// Every function annotation
+llvm::ArrayRef<AnnotationName> funcAnnotationNames();
+
 class FuncASTNode : public ASTNode {
   public:
-    FuncASTNode(Token ident, std::vector<Token> params, std::unique_ptr<CompoundStmtASTNode> &body)
-        : vis(Visibility::Public), identifier(ident), params(params), body(std::move(body)) {
+    FuncASTNode(uint32_t begin, uint32_t annotations, Visibility vis, Token ident, llvm::ArrayRef<Token> params,
+                CompoundStmtASTNode *body)
+        : vis(vis), annotations(annotations), begin(begin), identifier(ident), params(params), body(body) {
+    }
+
+    Symbol name() const {
+        return identifier.symbol;
+    }
+    Visibility visibility() const {
+        return vis;
+    }
+    bool hasAnnotation(FuncAnnotation annotation) const {
+        return annotations & annotation;
+    }
+    // Offset of the first token of the definition
+    uint32_t sourceBegin() const {
+        return begin;
+    }
+    size_t paramCount() const {
+        return params.size();
     }
 
-    llvm::Value *emit() const override;
-    void dbgprint(int indent) const override;
+    void fold(ConstEvaluator &eval);
+    // Interprets a call with the given arguments
+    bool evaluate(ConstEvaluator &eval, llvm::ArrayRef<int32_t> args, int32_t *result) const;
+    // Adds the function's prototype to the module, before any bodies are emitted
+    llvm::Function *declare(CodegenContext &ctx) const;
+    llvm::Value *emit(CodegenContext &ctx) const override;
+    void dbgprint(const SourceBuffer &src, int indent) const override;
 
   private:
     Visibility vis;
+    uint32_t annotations;
+    uint32_t begin;
     Token identifier;
-    std::vector<Token> params;
-    std::unique_ptr<CompoundStmtASTNode> body;
+    llvm::ArrayRef<Token> params;
+    CompoundStmtASTNode *body;
 };
 
 class SourceFileASTNode : public ASTNode {
   public:
-    explicit SourceFileASTNode(std::vector<std::unique_ptr<FuncASTNode>> funcs) : functions(std::move(funcs)) {
+    explicit SourceFileASTNode(llvm::ArrayRef<FuncASTNode *> funcs) : functions(funcs) {
     }
 
-    llvm::Value *emit() const override;
-    void dbgprint(int indent) const override;
+    llvm::ArrayRef<FuncASTNode *> definitions() const {
+        return functions;
+    }
+
+    void fold(ConstEvaluator &eval);
+    llvm::Value *emit(CodegenContext &ctx) const override;
+    // Declares every function, but only emits the bodies of the selected ones
+    // and of the private ones
+    void emitSelected(CodegenContext &ctx, const llvm::BitVector &selected) const;
+    void dbgprint(const SourceBuffer &src, int indent) const override;
 
   private:
-    std::vector<std::unique_ptr<FuncASTNode>> functions;
+    llvm::ArrayRef<FuncASTNode *> functions;
 };
-
-bool codegenInit(const std::string &moduleName);
-void codegenPrintIR();
-void codegenOutput(const std::string &filename);
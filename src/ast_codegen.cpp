@@ -1,186 +1,500 @@
 #include "ast.hpp"
+#include "codegen.hpp"
 
-#include <llvm/IR/IRBuilder.h>
-#include <llvm/IR/LLVMContext.h>
-#include <llvm/IR/LegacyPassManager.h>
-#include <llvm/IR/Module.h>
+#include <llvm/ADT/STLExtras.h>
 #include <llvm/IR/Verifier.h>
-#include <llvm/MC/TargetRegistry.h>
-#include <llvm/Support/FileSystem.h>
-#include <llvm/Support/TargetSelect.h>
-#include <llvm/Target/TargetMachine.h>
-#include <llvm/Target/TargetOptions.h>
-#include <llvm/TargetParser/Host.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Transforms/Utils/Local.h>
 
 #include <iostream>
+#include <optional>
+#include <vector>
 
-static std::unique_ptr<llvm::LLVMContext> context;
-static std::unique_ptr<llvm::Module> mainModule;
-static std::unique_ptr<llvm::IRBuilder<>> builder;
+llvm::Value *NumericExprASTNode::emit(CodegenContext &ctx) const {
+    return llvm::ConstantInt::getSigned(llvm::Type::getInt32Ty(*ctx.context), value);
+}
 
-static llvm::TargetMachine *targetMachine;
+llvm::Value *IdentifierExprASTNode::emit(CodegenContext &ctx) const {
+    std::optional<SSABuilder::Variable> variable = ctx.variables.lookup(identifier.symbol);
+    if (!variable) {
+        ctx.error(identifier.offset) << "Unknown identifier " << ctx.text(identifier) << std::endl;
+        return nullptr;
+    }
+    return ctx.ssa.read(*variable, ctx.builder->GetInsertBlock());
+}
 
-static std::unordered_map<std::string, llvm::FunctionType *> funcTypes;
-static std::unordered_map<std::string, llvm::Value *> funcParams;
-static std::unordered_map<std::string, llvm::AllocaInst *> localVariables;
+llvm::Value *FuncCallExprASTNode::emit(CodegenContext &ctx) const {
+    llvm::Function *callee = ctx.module->getFunction(ctx.text(function));
+    if (callee == nullptr) {
+        ctx.error(function.offset) << "Unknown function " << ctx.text(function) << std::endl;
+        return nullptr;
+    }
+    if (callee->arg_size() != arguments.size()) {
+        ctx.error(function.offset) << ctx.text(function) << " takes " << callee->arg_size() << " arguments, but "
+                                   << arguments.size() << " were given" << std::endl;
+        return nullptr;
+    }
 
-llvm::Value *NumericExprASTNode::emit() const {
-    int64_t value = std::stoi(number.contents);
-    return llvm::ConstantInt::get(*context, llvm::APInt(32, value, true));
+    std::vector<llvm::Value *> argValues;
+    for (const auto &arg : arguments) {
+        llvm::Value *value = arg->emit(ctx);
+        if (value == nullptr)
+            return nullptr;
+        argValues.push_back(value);
+    }
+    llvm::CallInst *call = ctx.builder->CreateCall(callee, argValues);
+    call->setCallingConv(callee->getCallingConv());
+    return call;
 }
 
-llvm::Value *IdentifierExprASTNode::emit() const {
-    if (funcParams.find(identifier.contents) != funcParams.end()) {
-        return funcParams[identifier.contents];
-    } else if (localVariables.find(identifier.contents) != localVariables.end()) {
-        return builder->CreateLoad(llvm::Type::getInt32Ty(*context), localVariables[identifier.contents]);
-    } else {
-        std::cerr << "Unknown identifier " << identifier.contents << std::endl;
+llvm::Value *FuncCallExprASTNode::emitTailCall(CodegenContext &ctx) const {
+    auto *call = llvm::cast_or_null<llvm::CallInst>(emit(ctx));
+    if (call == nullptr)
         return nullptr;
+
+    // A musttail call reuses the caller's stack frame at every optimization
+    // level, so recursion through return statements runs in constant stack
+    // space. The backend can only guarantee that when both functions take the
+    // same arguments the same way, and only on some targets.
+    llvm::Function *caller = ctx.builder->GetInsertBlock()->getParent();
+    llvm::Function *callee = call->getCalledFunction();
+    bool sameSignature = callee->getFunctionType() == caller->getFunctionType() &&
+                         callee->getCallingConv() == caller->getCallingConv();
+    if (sameSignature && ctx.guaranteesTailCalls(callee->arg_size())) {
+        call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+        return call;
+    }
+
+    // Otherwise the optimizer may still turn it into a jump, but without any
+    // guarantee, which functions annotated with @TailCall don't accept
+    call->setTailCallKind(llvm::CallInst::TCK_Tail);
+    if (ctx.function->hasAnnotation(AnnotateTailCall)) {
+        std::string_view calleeName = ctx.text(function), callerName = caller->getName();
+        std::ostream &error = ctx.error(function.offset)
+                              << "Call to " << calleeName << " can't be a tail call, ";
+        if (sameSignature) {
+            error << ctx.target.triple << " doesn't support guaranteed tail calls";
+            if (ctx.guaranteesTailCalls(0))
+                error << " with " << callee->arg_size() << " arguments";
+        } else if (callee->arg_size() != caller->arg_size()) {
+            error << calleeName << " takes " << callee->arg_size() << " arguments and " << callerName << " takes "
+                  << caller->arg_size();
+        } else {
+            bool callerPrivate = caller->getCallingConv() == llvm::CallingConv::Fast;
+            error << (callerPrivate ? callerName : calleeName) << " is private and "
+                  << (callerPrivate ? calleeName : callerName) << " is not";
+        }
+        error << std::endl;
     }
+    return call;
 }
 
-llvm::Value *FuncCallExprASTNode::emit() const {
-    llvm::Function *callee = mainModule->getFunction(function.contents);
-    std::vector<llvm::Value *> argValues;
-    for (const auto &arg : arguments) {
-        argValues.push_back(arg->emit());
+llvm::Value *UnaryOpExprASTNode::emit(CodegenContext &ctx) const {
+    llvm::Value *value = operand->emit(ctx);
+    if (value == nullptr)
+        return nullptr;
+
+    switch (op.type) {
+    case TokenType::Plus:
+        return value;
+    case TokenType::Minus:
+        return ctx.builder->CreateNeg(value);
+    default:
+        ctx.error(op.offset) << "Invalid unary operator in expression" << std::endl;
+        return nullptr;
     }
-    return builder->CreateCall(callee, argValues);
 }
 
-llvm::Value *UnaryOpExprASTNode::emit() const {
-    return builder->CreateNeg(operand->emit());
+// Divides like the constant folder does, with INT32_MIN / -1 wrapping to
+// INT32_MIN instead of being undefined and trapping on x86. Divisors only
+// known at runtime divide by 1 instead of -1 and negate the result.
+static llvm::Value *emitDivide(CodegenContext &ctx, llvm::Value *l, llvm::Value *r) {
+    if (auto *constant = llvm::dyn_cast<llvm::ConstantInt>(r))
+        return constant->isMinusOne() ? ctx.builder->CreateNeg(l) : ctx.builder->CreateSDiv(l, r);
+
+    llvm::Value *minusOne = ctx.builder->CreateICmpEQ(r, llvm::ConstantInt::getSigned(r->getType(), -1));
+    llvm::Value *divisor = ctx.builder->CreateSelect(minusOne, llvm::ConstantInt::get(r->getType(), 1), r);
+    llvm::Value *quotient = ctx.builder->CreateSDiv(l, divisor);
+    return ctx.builder->CreateSelect(minusOne, ctx.builder->CreateNeg(l), quotient);
 }
 
-llvm::Value *BinaryOpExprASTNode::emit() const {
+static std::optional<llvm::CmpInst::Predicate> comparisonPredicate(TokenType type) {
+    switch (type) {
+    case TokenType::Equal:
+        return llvm::CmpInst::ICMP_EQ;
+    case TokenType::NotEqual:
+        return llvm::CmpInst::ICMP_NE;
+    case TokenType::Less:
+        return llvm::CmpInst::ICMP_SLT;
+    case TokenType::LessEqual:
+        return llvm::CmpInst::ICMP_SLE;
+    case TokenType::Greater:
+        return llvm::CmpInst::ICMP_SGT;
+    case TokenType::GreaterEqual:
+        return llvm::CmpInst::ICMP_SGE;
+    default:
+        return std::nullopt;
+    }
+}
+
+llvm::Value *BinaryOpExprASTNode::emit(CodegenContext &ctx) const {
+    auto chain = leftChain(this);
+    llvm::Value *value = chain.back()->left->emit(ctx);
+    for (const BinaryOpExprASTNode *node : llvm::reverse(chain)) {
+        value = node->emitOperation(ctx, value);
+    }
+    return value;
+}
+
+llvm::Value *BinaryOpExprASTNode::emitOperation(CodegenContext &ctx, llvm::Value *l) const {
+    // Comparisons give an int as well, 1 if they hold and 0 otherwise
+    if (comparisonPredicate(op.type)) {
+        llvm::Value *holds = emitComparison(ctx, l);
+        return holds != nullptr ? ctx.builder->CreateZExt(holds, llvm::Type::getInt32Ty(*ctx.context)) : nullptr;
+    }
+
+    llvm::Value *r = right->emit(ctx);
+    if (l == nullptr || r == nullptr)
+        return nullptr;
+
     switch (op.type) {
     case TokenType::Plus:
-        return builder->CreateAdd(left->emit(), right->emit());
+        return ctx.builder->CreateAdd(l, r);
     case TokenType::Minus:
-        return builder->CreateSub(left->emit(), right->emit());
+        return ctx.builder->CreateSub(l, r);
     case TokenType::Multiply:
-        return builder->CreateMul(left->emit(), right->emit());
+        return ctx.builder->CreateMul(l, r);
     case TokenType::Divide:
-        return builder->CreateSDiv(left->emit(), right->emit());
+        return emitDivide(ctx, l, r);
     default:
-        std::cerr << "Invalid binary operator in expression";
+        ctx.error(op.offset) << "Invalid binary operator in expression" << std::endl;
         return nullptr;
     }
 }
 
-llvm::Value *ReturnStmtASTNode::emit() const {
-    return builder->CreateRet(expr->emit());
+llvm::Value *ExprASTNode::emitCondition(CodegenContext &ctx) const {
+    llvm::Value *value = emit(ctx);
+    if (value == nullptr)
+        return nullptr;
+    return ctx.builder->CreateICmpNE(value, llvm::ConstantInt::get(value->getType(), 0));
 }
 
-llvm::Value *VariableDeclStmtASTNode::emit() const {
-    auto alloc = builder->CreateAlloca(llvm::Type::getInt32Ty(*context), nullptr, identifier.contents);
-    localVariables[identifier.contents] = alloc;
+// Comparisons are branched on directly, without extending them to an int
+llvm::Value *BinaryOpExprASTNode::emitCondition(CodegenContext &ctx) const {
+    if (!comparisonPredicate(op.type))
+        return ExprASTNode::emitCondition(ctx);
+    return emitComparison(ctx, left->emit(ctx));
+}
+
+llvm::Value *BinaryOpExprASTNode::emitComparison(CodegenContext &ctx, llvm::Value *l) const {
+    llvm::Value *r = right->emit(ctx);
+    if (l == nullptr || r == nullptr)
+        return nullptr;
+    return ctx.builder->CreateICmp(*comparisonPredicate(op.type), l, r);
+}
+
+llvm::Value *ReturnStmtASTNode::emit(CodegenContext &ctx) const {
+    const FuncCallExprASTNode *call = expr->asCall();
+    llvm::Value *value = call != nullptr ? call->emitTailCall(ctx) : expr->emit(ctx);
+    if (value == nullptr)
+        return nullptr;
+    return ctx.builder->CreateRet(value);
+}
+
+llvm::Value *VariableDeclStmtASTNode::emit(CodegenContext &ctx) const {
+    // The variable is already in scope in its own initializer, where reading
+    // it gives an undefined value
+    SSABuilder::Variable variable = ctx.ssa.addVariable(llvm::Type::getInt32Ty(*ctx.context));
+    if (!ctx.variables.declare(identifier.symbol, variable)) {
+        ctx.error(identifier.offset) << "Redeclaration of " << ctx.text(identifier) << std::endl;
+    }
+    llvm::Value *initValue = llvm::ConstantInt::get(*ctx.context, llvm::APInt(32, 0));
     if (initExpr) {
-        builder->CreateStore(initExpr->emit(), alloc);
-    } else {
-        builder->CreateStore(llvm::ConstantInt::get(*context, llvm::APInt(32, 0)), alloc);
+        initValue = initExpr->emit(ctx);
+        if (initValue == nullptr)
+            return nullptr;
     }
-    return alloc;
+    ctx.ssa.write(variable, ctx.builder->GetInsertBlock(), initValue);
+    return initValue;
 }
 
-llvm::Value *AssignmentStmtASTNode::emit() const {
-    if (funcParams.find(identifier.contents) != funcParams.end()) {
-        return builder->CreateStore(expression->emit(), funcParams[identifier.contents]);
-    } else if (localVariables.find(identifier.contents) != localVariables.end()) {
-        return builder->CreateStore(expression->emit(), localVariables[identifier.contents]);
-    } else {
-        std::cerr << "Unknown identifier " << identifier.contents << std::endl;
+llvm::Value *AssignmentStmtASTNode::emit(CodegenContext &ctx) const {
+    std::optional<SSABuilder::Variable> variable = ctx.variables.lookup(identifier.symbol);
+    if (!variable) {
+        ctx.error(identifier.offset) << "Unknown identifier " << ctx.text(identifier) << std::endl;
         return nullptr;
     }
+    llvm::Value *value = expression->emit(ctx);
+    if (value == nullptr)
+        return nullptr;
+    ctx.ssa.write(*variable, ctx.builder->GetInsertBlock(), value);
+    return value;
 }
 
-llvm::Value *CompoundStmtASTNode::emit() const {
+llvm::Value *CompoundStmtASTNode::emit(CodegenContext &ctx) const {
+    ctx.variables.pushScope();
     for (auto &&stmt : stmts) {
-        stmt->emit();
+        // Statements after a return can't be reached, but they are still
+        // emitted to report their errors, into a block that nothing branches
+        // to. The function drops those blocks once it's complete.
+        llvm::BasicBlock *current = ctx.builder->GetInsertBlock();
+        if (current->getTerminator() != nullptr) {
+            llvm::BasicBlock *unreachable = llvm::BasicBlock::Create(*ctx.context, "unreachable", current->getParent());
+            ctx.ssa.seal(unreachable);
+            ctx.builder->SetInsertPoint(unreachable);
+        }
+        stmt->emit(ctx);
     }
+    ctx.variables.popScope();
     return nullptr;
 }
 
-llvm::Value *FuncASTNode::emit() const {
-    std::vector<llvm::Type *> arguments(params.size(), llvm::Type::getInt32Ty(*context));
+// Emits a branch or loop body into its block, which only the block of the
+// condition branches to, and continues with next unless it returned. Returns
+// the branch to next, if there is one.
+static llvm::BranchInst *emitBody(CodegenContext &ctx, const StmtASTNode *stmt, llvm::BasicBlock *block,
+                                  llvm::BasicBlock *next) {
+    block->insertInto(ctx.builder->GetInsertBlock()->getParent());
+    ctx.ssa.seal(block);
+    ctx.builder->SetInsertPoint(block);
+
+    // Even a body that is a single declaration has a scope of its own
+    ctx.variables.pushScope();
+    stmt->emit(ctx);
+    ctx.variables.popScope();
+
+    if (ctx.builder->GetInsertBlock()->getTerminator() != nullptr)
+        return nullptr;
+    return ctx.builder->CreateBr(next);
+}
 
-    llvm::FunctionType *funcType = llvm::FunctionType::get(llvm::Type::getInt32Ty(*context), arguments, false);
-    llvm::Function *func =
-        llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, identifier.contents, *mainModule);
+llvm::Value *IfStmtASTNode::emit(CodegenContext &ctx) const {
+    llvm::Value *value = condition->emitCondition(ctx);
+    if (value == nullptr)
+        return nullptr;
 
-    funcParams.clear();
-    localVariables.clear();
+    llvm::BasicBlock *thenBlock = llvm::BasicBlock::Create(*ctx.context, "if.then");
+    llvm::BasicBlock *elseBlock = elseStmt ? llvm::BasicBlock::Create(*ctx.context, "if.else") : nullptr;
+    llvm::BasicBlock *endBlock = llvm::BasicBlock::Create(*ctx.context, "if.end");
+    ctx.builder->CreateCondBr(value, thenBlock, elseBlock ? elseBlock : endBlock);
 
-    unsigned index = 0;
-    for (auto &arg : func->args()) {
-        funcParams[params[index].contents] = &arg;
-        index++;
-    }
+    emitBody(ctx, thenStmt, thenBlock, endBlock);
+    if (elseStmt)
+        emitBody(ctx, elseStmt, elseBlock, endBlock);
 
-    llvm::BasicBlock *block = llvm::BasicBlock::Create(*context, "entry", func);
-    builder->SetInsertPoint(block);
-    body->emit();
+    // When both branches return the end has no predecessors, and whatever
+    // follows can't be reached
+    endBlock->insertInto(ctx.builder->GetInsertBlock()->getParent());
+    ctx.ssa.seal(endBlock);
+    ctx.builder->SetInsertPoint(endBlock);
+    return nullptr;
+}
 
-    llvm::verifyFunction(*func);
+// The llvm.loop metadata for the loop's annotations, which goes on the
+// branch back to the top of the loop
+static llvm::MDNode *loopMetadata(CodegenContext &ctx, const LoopHints &hints) {
+    llvm::LLVMContext &context = *ctx.context;
+    // The first operand refers to the node itself, which keeps it distinct
+    llvm::SmallVector<llvm::Metadata *, 4> operands = {nullptr};
+    auto addProperty = [&](const char *name, llvm::Type *type = nullptr, uint64_t value = 0) {
+        llvm::SmallVector<llvm::Metadata *, 2> property = {llvm::MDString::get(context, name)};
+        if (type != nullptr)
+            property.push_back(llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(type, value)));
+        operands.push_back(llvm::MDNode::get(context, property));
+    };
+
+    llvm::Type *i1 = llvm::Type::getInt1Ty(context);
+    llvm::Type *i32 = llvm::Type::getInt32Ty(context);
+    if (hints.annotations & AnnotateUnroll) {
+        if (hints.unrollCount != 0) {
+            addProperty("llvm.loop.unroll.count", i32, hints.unrollCount);
+        } else {
+            addProperty("llvm.loop.unroll.enable");
+        }
+    }
+    if (hints.annotations & AnnotateNoUnroll) {
+        addProperty("llvm.loop.unroll.disable");
+    }
+    if (hints.annotations & AnnotateVectorize) {
+        addProperty("llvm.loop.vectorize.enable", i1, 1);
+        if (hints.vectorizeWidth != 0) {
+            addProperty("llvm.loop.vectorize.width", i32, hints.vectorizeWidth);
+        }
+    }
+    if (hints.annotations & AnnotateNoVectorize) {
+        addProperty("llvm.loop.vectorize.width", i32, 1);
+    }
 
-    return func;
+    llvm::MDNode *loop = llvm::MDNode::getDistinct(context, operands);
+    loop->replaceOperandWith(0, loop);
+    return loop;
 }
 
-llvm::Value *SourceFileASTNode::emit() const {
-    for (const auto &func : functions) {
-        func->emit();
+llvm::Value *LoopStmtASTNode::emit(CodegenContext &ctx) const {
+    // Variables declared by the initialization are only in scope in the loop
+    ctx.variables.pushScope();
+    if (init)
+        init->emit(ctx);
+
+    // The condition block isn't sealed until the branch back to it has been
+    // emitted, the variables read in the loop get phis there. The others
+    // only have a single predecessor.
+    llvm::BasicBlock *condBlock =
+        llvm::BasicBlock::Create(*ctx.context, "loop.cond", ctx.builder->GetInsertBlock()->getParent());
+    ctx.builder->CreateBr(condBlock);
+    ctx.builder->SetInsertPoint(condBlock);
+
+    // A loop whose condition is always true only ends by returning, and the
+    // code after it can't be reached
+    int32_t constant;
+    bool alwaysTrue = condition == nullptr || (condition->constantValue(&constant) && constant != 0);
+    llvm::Value *value = nullptr;
+    if (!alwaysTrue) {
+        value = condition->emitCondition(ctx);
+        if (value == nullptr) {
+            // The rest of the function goes on in the condition block, which
+            // nothing branches back to
+            ctx.ssa.seal(condBlock);
+            ctx.variables.popScope();
+            return nullptr;
+        }
+    }
+
+    llvm::BasicBlock *bodyBlock = llvm::BasicBlock::Create(*ctx.context, "loop.body");
+    llvm::BasicBlock *stepBlock = step ? llvm::BasicBlock::Create(*ctx.context, "loop.step") : nullptr;
+    llvm::BasicBlock *endBlock = llvm::BasicBlock::Create(*ctx.context, "loop.end");
+    if (alwaysTrue) {
+        ctx.builder->CreateBr(bodyBlock);
+    } else {
+        ctx.builder->CreateCondBr(value, bodyBlock, endBlock);
+    }
+
+    llvm::BranchInst *latch = emitBody(ctx, body, bodyBlock, stepBlock ? stepBlock : condBlock);
+    if (stepBlock) {
+        stepBlock->insertInto(condBlock->getParent());
+        ctx.ssa.seal(stepBlock);
+        ctx.builder->SetInsertPoint(stepBlock);
+        step->emit(ctx);
+        latch = ctx.builder->CreateBr(condBlock);
+    }
+    ctx.ssa.seal(condBlock);
+    if (latch != nullptr && hints.annotations != 0) {
+        latch->setMetadata(llvm::LLVMContext::MD_loop, loopMetadata(ctx, hints));
     }
+
+    endBlock->insertInto(condBlock->getParent());
+    ctx.ssa.seal(endBlock);
+    ctx.builder->SetInsertPoint(endBlock);
+    ctx.variables.popScope();
     return nullptr;
 }
 
-bool codegenInit(const std::string &moduleName) {
-    context = std::make_unique<llvm::LLVMContext>();
-    mainModule = std::make_unique<llvm::Module>(moduleName, *context);
-    builder = std::make_unique<llvm::IRBuilder<>>(*context);
+llvm::Function *FuncASTNode::declare(CodegenContext &ctx) const {
+    if (ctx.module->getFunction(ctx.text(identifier)) != nullptr) {
+        ctx.error(identifier.offset) << "Redefinition of function " << ctx.text(identifier) << std::endl;
+        return nullptr;
+    }
+
+    std::vector<llvm::Type *> arguments(params.size(), llvm::Type::getInt32Ty(*ctx.context));
+
+    // Private functions can only be called from their own file, so the
+    // optimizer is free to inline, specialize or drop them, and to pick a
+    // faster calling convention. Protected ones are visible to the other
+    // files linked into the same binary, but aren't exported from it.
+    llvm::FunctionType *funcType = llvm::FunctionType::get(llvm::Type::getInt32Ty(*ctx.context), arguments, false);
+    llvm::Function *func = llvm::Function::Create(
+        funcType, vis == Visibility::Private ? llvm::Function::InternalLinkage : llvm::Function::ExternalLinkage,
+        llvm::StringRef(ctx.text(identifier)), *ctx.module);
+    if (vis == Visibility::Private) {
+        func->setCallingConv(llvm::CallingConv::Fast);
+    } else if (vis == Visibility::Protected) {
+        func->setVisibility(llvm::GlobalValue::HiddenVisibility);
+    }
+
+    // Hints from the annotations, for the inliner and for how much to
+    // optimize and where to place the code, which a profile would give
+    // otherwise
+    if (hasAnnotation(AnnotateHot)) {
+        func->addFnAttr(llvm::Attribute::Hot);
+    } else if (hasAnnotation(AnnotateCold)) {
+        func->addFnAttr(llvm::Attribute::Cold);
+    }
+    if (hasAnnotation(AnnotateInline)) {
+        func->addFnAttr(llvm::Attribute::AlwaysInline);
+    } else if (hasAnnotation(AnnotateNoInline)) {
+        func->addFnAttr(llvm::Attribute::NoInline);
+    }
+    func->addFnAttr("target-cpu", ctx.target.cpu);
+    if (!ctx.target.features.empty()) {
+        func->addFnAttr("target-features", ctx.target.features);
+    }
+    return func;
+}
 
-    std::string targetTriple = llvm::sys::getDefaultTargetTriple();
+llvm::Value *FuncASTNode::emit(CodegenContext &ctx) const {
+    llvm::TimeTraceScope traceScope("EmitFunction", [&]() { return std::string(ctx.text(identifier)); });
+    llvm::Function *func = ctx.module->getFunction(ctx.text(identifier));
 
-    llvm::InitializeAllTargetInfos();
-    llvm::InitializeAllTargets();
-    llvm::InitializeAllTargetMCs();
-    llvm::InitializeAllAsmParsers();
-    llvm::InitializeAllAsmPrinters();
+    // Nothing branches to the entry block, so it's sealed right away
+    llvm::BasicBlock *block = llvm::BasicBlock::Create(*ctx.context, "entry", func);
+    ctx.builder->SetInsertPoint(block);
+    ctx.function = this;
+    ctx.ssa.clear();
+    ctx.ssa.seal(block);
 
-    std::string errorMsg;
-    const llvm::Target *target = llvm::TargetRegistry::lookupTarget(targetTriple, errorMsg);
-    if (target == nullptr) {
-        std::cerr << "Unable to look up target triple " << targetTriple << ": " << errorMsg << std::endl;
-        return false;
+    // Parameters are variables like any other, that start out with the
+    // argument's value
+    ctx.variables.pushScope();
+    unsigned index = 0;
+    for (auto &arg : func->args()) {
+        arg.setName(ctx.text(params[index]));
+        SSABuilder::Variable variable = ctx.ssa.addVariable(arg.getType());
+        ctx.ssa.write(variable, block, &arg);
+        if (!ctx.variables.declare(params[index].symbol, variable)) {
+            ctx.error(params[index].offset) << "Duplicate parameter " << ctx.text(params[index]) << std::endl;
+        }
+        index++;
     }
 
-    std::string targetCpu = "generic";
-    std::string targetFeatures = "";
-    llvm::TargetOptions targetOptions;
-    targetMachine =
-        target->createTargetMachine(targetTriple, targetCpu, targetFeatures, targetOptions, llvm::Reloc::Static);
+    body->emit(ctx);
+    ctx.variables.popScope();
+
+    // Blocks that nothing branches to are dropped, like the ones with the code
+    // after a return. The end of the function is only allowed to be among
+    // them, there is no value to return there.
+    if (!ctx.hadError()) {
+        llvm::WeakVH end;
+        if (ctx.builder->GetInsertBlock()->getTerminator() == nullptr)
+            end = ctx.builder->CreateUnreachable();
+        llvm::removeUnreachableBlocks(*func);
+        if (end != nullptr) {
+            ctx.error(identifier.offset) << "Function " << ctx.text(identifier)
+                                         << " can reach its end without returning a value" << std::endl;
+        }
+    }
 
-    mainModule->setDataLayout(targetMachine->createDataLayout());
-    mainModule->setTargetTriple(targetTriple);
+    llvm::verifyFunction(*func);
 
-    return true;
+    return func;
 }
 
-void codegenPrintIR() {
-    mainModule->print(llvm::outs(), nullptr);
+llvm::Value *SourceFileASTNode::emit(CodegenContext &ctx) const {
+    emitSelected(ctx, llvm::BitVector(functions.size(), true));
+    return nullptr;
 }
 
-void codegenOutput(const std::string &filename) {
-    std::error_code errCode;
-    llvm::raw_fd_ostream outfile(filename, errCode, llvm::sys::fs::OF_None);
-
-    llvm::legacy::PassManager passManager;
-
-    if (targetMachine->addPassesToEmitFile(passManager, outfile, nullptr, llvm::CodeGenFileType::ObjectFile)) {
-        std::cerr << "Could not add object file emit to pass manager" << std::endl;
-        return;
+void SourceFileASTNode::emitSelected(CodegenContext &ctx, const llvm::BitVector &selected) const {
+    // Declare every function first, so they can be called before the point
+    // where they are defined
+    for (const auto &func : functions) {
+        if (func->declare(ctx) == nullptr)
+            return;
+    }
+    // Private functions are always emitted, since the objects of the selected
+    // functions get copies of the private ones they call
+    for (size_t i = 0; i < functions.size(); i++) {
+        if (selected[i] || functions[i]->visibility() == Visibility::Private) {
+            functions[i]->emit(ctx);
+        }
     }
-
-    passManager.run(*mainModule);
-    outfile.flush();
 }
@@ -0,0 +1,315 @@
+#include "ast.hpp"
+#include "consteval.hpp"
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
+
+#include <iostream>
+
+// Arithmetic wraps around like Java's int, and division truncates towards zero
+// with INT32_MIN / -1 wrapping back to INT32_MIN. Comparisons give 1 or 0.
+// Returns false when dividing by zero.
+static bool applyBinaryOp(TokenType op, int32_t l, int32_t r, int32_t *result) {
+    uint32_t ul = static_cast<uint32_t>(l);
+    uint32_t ur = static_cast<uint32_t>(r);
+    switch (op) {
+    case TokenType::Plus:
+        *result = static_cast<int32_t>(ul + ur);
+        return true;
+    case TokenType::Minus:
+        *result = static_cast<int32_t>(ul - ur);
+        return true;
+    case TokenType::Multiply:
+        *result = static_cast<int32_t>(ul * ur);
+        return true;
+    case TokenType::Divide:
+        if (r == 0)
+            return false;
+        *result = r == -1 ? static_cast<int32_t>(0u - ul) : l / r;
+        return true;
+    case TokenType::Equal:
+        *result = l == r;
+        return true;
+    case TokenType::NotEqual:
+        *result = l != r;
+        return true;
+    case TokenType::Less:
+        *result = l < r;
+        return true;
+    case TokenType::LessEqual:
+        *result = l <= r;
+        return true;
+    case TokenType::Greater:
+        *result = l > r;
+        return true;
+    case TokenType::GreaterEqual:
+        *result = l >= r;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool applyUnaryOp(TokenType op, int32_t value, int32_t *result) {
+    switch (op) {
+    case TokenType::Plus:
+        *result = value;
+        return true;
+    case TokenType::Minus:
+        *result = static_cast<int32_t>(0u - static_cast<uint32_t>(value));
+        return true;
+    default:
+        return false;
+    }
+}
+
+ExprASTNode *NumericExprASTNode::fold(ConstEvaluator &eval) {
+    return this;
+}
+
+bool NumericExprASTNode::evaluate(ConstEvaluator &eval, int32_t *result) const {
+    *result = value;
+    return eval.step();
+}
+
+bool NumericExprASTNode::constantValue(int32_t *result) const {
+    *result = value;
+    return true;
+}
+
+ExprASTNode *IdentifierExprASTNode::fold(ConstEvaluator &eval) {
+    return this;
+}
+
+bool IdentifierExprASTNode::evaluate(ConstEvaluator &eval, int32_t *value) const {
+    std::optional<int32_t> variable = eval.variables.lookup(identifier.symbol);
+    if (!variable)
+        return false;
+    *value = *variable;
+    return eval.step();
+}
+
+ExprASTNode *FuncCallExprASTNode::fold(ConstEvaluator &eval) {
+    eval.noteCall(function.symbol);
+
+    llvm::SmallVector<int32_t, 4> values;
+    for (auto &arg : arguments) {
+        arg = arg->fold(eval);
+        int32_t value;
+        if (arg->constantValue(&value))
+            values.push_back(value);
+    }
+
+    int32_t result;
+    if (values.size() != arguments.size() || !eval.call(function.symbol, values, &result))
+        return this;
+    return eval.constant(function, result);
+}
+
+bool FuncCallExprASTNode::evaluate(ConstEvaluator &eval, int32_t *value) const {
+    llvm::SmallVector<int32_t, 4> values;
+    for (const auto &arg : arguments) {
+        int32_t argValue;
+        if (!arg->evaluate(eval, &argValue))
+            return false;
+        values.push_back(argValue);
+    }
+    return eval.step() && eval.call(function.symbol, values, value);
+}
+
+ExprASTNode *UnaryOpExprASTNode::fold(ConstEvaluator &eval) {
+    operand = operand->fold(eval);
+
+    int32_t value, result;
+    if (operand->constantValue(&value) && applyUnaryOp(op.type, value, &result))
+        return eval.constant(op, result);
+    return this;
+}
+
+bool UnaryOpExprASTNode::evaluate(ConstEvaluator &eval, int32_t *value) const {
+    int32_t operandValue;
+    return operand->evaluate(eval, &operandValue) && applyUnaryOp(op.type, operandValue, value) && eval.step();
+}
+
+ExprASTNode *BinaryOpExprASTNode::fold(ConstEvaluator &eval) {
+    auto chain = leftChain(this);
+    ExprASTNode *folded = chain.back()->left->fold(eval);
+    for (BinaryOpExprASTNode *node : llvm::reverse(chain)) {
+        node->left = folded;
+        folded = node->foldOperation(eval);
+    }
+    return folded;
+}
+
+ExprASTNode *BinaryOpExprASTNode::foldOperation(ConstEvaluator &eval) {
+    right = right->fold(eval);
+
+    int32_t l, r, result;
+    bool rightConstant = right->constantValue(&r);
+    if (op.type == TokenType::Divide && rightConstant && r == 0) {
+        eval.error(op.offset) << "Division by zero" << std::endl;
+        return this;
+    }
+    if (left->constantValue(&l) && rightConstant && applyBinaryOp(op.type, l, r, &result))
+        return eval.constant(op, result);
+    return this;
+}
+
+bool BinaryOpExprASTNode::evaluate(ConstEvaluator &eval, int32_t *value) const {
+    auto chain = leftChain(this);
+    int32_t result;
+    if (!chain.back()->left->evaluate(eval, &result))
+        return false;
+    for (const BinaryOpExprASTNode *node : llvm::reverse(chain)) {
+        int32_t r;
+        if (!node->right->evaluate(eval, &r) || !applyBinaryOp(node->op.type, result, r, &result) || !eval.step())
+            return false;
+    }
+    *value = result;
+    return true;
+}
+
+void ReturnStmtASTNode::fold(ConstEvaluator &eval) {
+    expr = expr->fold(eval);
+}
+
+bool ReturnStmtASTNode::execute(ConstEvaluator &eval) const {
+    int32_t value;
+    if (!expr->evaluate(eval, &value))
+        return false;
+    eval.setReturnValue(value);
+    return true;
+}
+
+void VariableDeclStmtASTNode::fold(ConstEvaluator &eval) {
+    if (initExpr)
+        initExpr = initExpr->fold(eval);
+}
+
+bool VariableDeclStmtASTNode::execute(ConstEvaluator &eval) const {
+    // Like in codegen the variable is in scope in its own initializer, where
+    // it has no value yet
+    if (!eval.variables.declare(identifier.symbol, std::nullopt))
+        return false;
+
+    int32_t value = 0;
+    if (initExpr && !initExpr->evaluate(eval, &value))
+        return false;
+    return eval.variables.assign(identifier.symbol, value) && eval.step();
+}
+
+void AssignmentStmtASTNode::fold(ConstEvaluator &eval) {
+    expression = expression->fold(eval);
+}
+
+bool AssignmentStmtASTNode::execute(ConstEvaluator &eval) const {
+    int32_t value;
+    if (!expression->evaluate(eval, &value))
+        return false;
+    return eval.variables.lookup(identifier.symbol) && eval.variables.assign(identifier.symbol, value)
+           && eval.step();
+}
+
+void CompoundStmtASTNode::fold(ConstEvaluator &eval) {
+    for (const auto &stmt : stmts) {
+        stmt->fold(eval);
+    }
+}
+
+bool CompoundStmtASTNode::execute(ConstEvaluator &eval) const {
+    bool succeeded = true;
+    eval.variables.pushScope();
+    for (const auto &stmt : stmts) {
+        succeeded = stmt->execute(eval);
+        if (!succeeded || eval.returned())
+            break;
+    }
+    eval.variables.popScope();
+    return succeeded;
+}
+
+void IfStmtASTNode::fold(ConstEvaluator &eval) {
+    condition = condition->fold(eval);
+    thenStmt->fold(eval);
+    if (elseStmt)
+        elseStmt->fold(eval);
+}
+
+// The branches and loop bodies get a scope of their own, as in codegen
+static bool executeInScope(ConstEvaluator &eval, const StmtASTNode *stmt) {
+    eval.variables.pushScope();
+    bool succeeded = stmt->execute(eval);
+    eval.variables.popScope();
+    return succeeded;
+}
+
+bool IfStmtASTNode::execute(ConstEvaluator &eval) const {
+    int32_t value;
+    if (!condition->evaluate(eval, &value))
+        return false;
+    if (value != 0)
+        return executeInScope(eval, thenStmt);
+    return elseStmt == nullptr || executeInScope(eval, elseStmt);
+}
+
+void LoopStmtASTNode::fold(ConstEvaluator &eval) {
+    if (init)
+        init->fold(eval);
+    if (condition)
+        condition = condition->fold(eval);
+    if (step)
+        step->fold(eval);
+    body->fold(eval);
+}
+
+bool LoopStmtASTNode::execute(ConstEvaluator &eval) const {
+    eval.variables.pushScope();
+    bool succeeded = init == nullptr || init->execute(eval);
+    while (succeeded) {
+        // Every iteration counts as a step, so even an empty loop without a
+        // condition runs out of budget
+        int32_t value = 1;
+        succeeded = eval.step() && (condition == nullptr || condition->evaluate(eval, &value));
+        if (!succeeded || value == 0)
+            break;
+        succeeded = executeInScope(eval, body);
+        if (!succeeded || eval.returned())
+            break;
+        succeeded = step == nullptr || step->execute(eval);
+    }
+    eval.variables.popScope();
+    return succeeded;
+}
+
+void FuncASTNode::fold(ConstEvaluator &eval) {
+    eval.startFolding(this);
+    body->fold(eval);
+}
+
+bool FuncASTNode::evaluate(ConstEvaluator &eval, llvm::ArrayRef<int32_t> args, int32_t *result) const {
+    // The caller's variables stay in the table, but the scope shadows them and
+    // code that refers to them doesn't compile anyway
+    bool succeeded = true;
+    eval.variables.pushScope();
+    for (size_t i = 0; i < params.size() && succeeded; i++) {
+        succeeded = eval.variables.declare(params[i].symbol, args[i]);
+    }
+    succeeded = succeeded && body->execute(eval);
+    eval.variables.popScope();
+
+    // Running off the end of the function doesn't produce a value either
+    std::optional<int32_t> value = eval.takeReturnValue();
+    if (!succeeded || !value)
+        return false;
+    *result = *value;
+    return true;
+}
+
+void SourceFileASTNode::fold(ConstEvaluator &eval) {
+    for (const auto &func : functions) {
+        eval.define(func);
+    }
+    for (const auto &func : functions) {
+        func->fold(eval);
+    }
+}
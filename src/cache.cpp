@@ -0,0 +1,139 @@
+#include "cache.hpp"
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA256.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <unistd.h>
+
+#include "driver.hpp"
+
+// Any change to kopic may change the code it generates. The Makefile passes a
+// hash of the sources, builds without one fall back to the executable's size
+// and modification time, or to not sharing objects with other processes.
+static std::string buildIdentity() {
+#ifdef KOPIC_BUILD_ID
+    return KOPIC_BUILD_ID;
+#else
+    static const std::string identity = []() {
+        std::string path = llvm::sys::fs::getMainExecutable(nullptr, reinterpret_cast<void *>(&buildIdentity));
+        llvm::sys::fs::file_status status;
+        if (path.empty() || llvm::sys::fs::status(path, status))
+            return "process " + std::to_string(getpid());
+        return path + ' ' + std::to_string(status.getSize()) + ' '
+               + std::to_string(status.getLastModificationTime().time_since_epoch().count());
+    }();
+    return identity;
+#endif
+}
+
+static void hashField(llvm::SHA256 &hasher, llvm::StringRef field) {
+    // Length prefixed, so that moving characters between fields changes the hash
+    uint64_t length = field.size();
+    hasher.update(llvm::StringRef(reinterpret_cast<const char *>(&length), sizeof(length)));
+    hasher.update(field);
+}
+
+std::string ObjectCache::key(llvm::StringRef sourceText, const CodegenOptions &options) {
+    TargetDescription target = codegenResolveTarget(options);
+
+    llvm::SHA256 hasher;
+    hashField(hasher, kopicVersion);
+    hashField(hasher, buildIdentity());
+    hashField(hasher, LLVM_VERSION_STRING);
+    hashField(hasher, target.triple);
+    hashField(hasher, target.cpu);
+    hashField(hasher, target.features);
+    hashField(hasher, llvm::StringRef(&options.optLevel, 1));
+    hashField(hasher, options.pic ? "pic" : "static");
+    hashField(hasher, std::to_string(options.parallelCodegen));
+    hashField(hasher, std::to_string(static_cast<int>(options.emit)));
+    hashField(hasher, options.thinLTO ? "thinlto" : "nolto");
+    hashField(hasher, options.profileGenerate ? "profile-generate=" + options.profileGenerateFile : "");
+    // The profile's contents rather than its name, since it's usually
+    // regenerated in place
+    if (!options.profileUse.empty()) {
+        auto profile = llvm::MemoryBuffer::getFile(options.profileUse);
+        hashField(hasher, profile ? (*profile)->getBuffer() : llvm::StringRef(options.profileUse));
+    } else {
+        hashField(hasher, "");
+    }
+    hashField(hasher, sourceText);
+    return llvm::toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+std::string ObjectCache::functionKey(llvm::ArrayRef<llvm::StringRef> definitions, const std::string &optionsKey) {
+    llvm::SHA256 hasher;
+    hashField(hasher, optionsKey);
+    for (llvm::StringRef definition : definitions) {
+        hashField(hasher, definition);
+    }
+    return llvm::toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+std::string ObjectCache::objectPath(const std::string &key) const {
+    llvm::SmallString<128> path(directory);
+    llvm::sys::path::append(path, key + ".o");
+    return std::string(path);
+}
+
+bool ObjectCache::fetch(const std::string &key, const std::string &outputPath) {
+    if (llvm::sys::fs::copy_file(objectPath(key), outputPath)) {
+        numMisses++;
+        return false;
+    }
+    numHits++;
+    return true;
+}
+
+bool ObjectCache::contains(const std::string &key) const {
+    return llvm::sys::fs::exists(objectPath(key));
+}
+
+bool ObjectCache::createTempFile(const std::string &key, llvm::SmallVectorImpl<char> &tempPath, int &fd) {
+    if (llvm::sys::fs::create_directories(directory))
+        return false;
+
+    // Objects are written to a unique name first and renamed into place, so
+    // concurrent compilations never see a partially written object
+    tempPath.assign(directory.begin(), directory.end());
+    llvm::sys::path::append(tempPath, key + "-%%%%%%.tmp");
+    return !llvm::sys::fs::createUniqueFile(tempPath, fd, tempPath);
+}
+
+void ObjectCache::store(const std::string &key, const std::string &objectFile) {
+    llvm::SmallString<128> tempPath;
+    int fd;
+    if (!createTempFile(key, tempPath, fd))
+        return;
+    close(fd);
+
+    if (llvm::sys::fs::copy_file(objectFile, tempPath) || llvm::sys::fs::rename(tempPath, objectPath(key))) {
+        llvm::sys::fs::remove(tempPath);
+    }
+}
+
+bool ObjectCache::store(const std::string &key, llvm::ArrayRef<char> object) {
+    llvm::SmallString<128> tempPath;
+    int fd;
+    if (!createTempFile(key, tempPath, fd))
+        return false;
+
+    bool written;
+    {
+        llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+        os.write(object.data(), object.size());
+        os.close();
+        written = !os.has_error();
+        os.clear_error();
+    }
+    if (!written || llvm::sys::fs::rename(tempPath, objectPath(key))) {
+        llvm::sys::fs::remove(tempPath);
+        return false;
+    }
+    return true;
+}
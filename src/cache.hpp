@@ -0,0 +1,55 @@
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <atomic>
+#include <string>
+
+#include "codegen.hpp"
+
+// On-disk cache of object files, addressed by a hash of everything that can
+// affect the generated code. Safe to share between concurrent compilations
+// and kopic processes.
+class ObjectCache {
+  public:
+    explicit ObjectCache(std::string directory) : directory(std::move(directory)) {
+    }
+
+    // Hashes the source text together with the compiler version and every
+    // option that changes the generated object.
+    static std::string key(llvm::StringRef sourceText, const CodegenOptions &options);
+    // Key of a single function for -fincremental, from its definition followed
+    // by the definitions it depends on, and the key of the options without
+    // any source, key("", options)
+    static std::string functionKey(llvm::ArrayRef<llvm::StringRef> definitions, const std::string &optionsKey);
+
+    // Copies the cached object for the key to the output path. Returns false
+    // if there is no such object.
+    bool fetch(const std::string &key, const std::string &outputPath);
+    // Adds a freshly compiled object to the cache
+    void store(const std::string &key, const std::string &objectPath);
+    // Adds an object compiled in memory, returns false if it couldn't be
+    // written
+    bool store(const std::string &key, llvm::ArrayRef<char> object);
+
+    // Cached objects are used in place by -fincremental instead of being copied
+    bool contains(const std::string &key) const;
+    std::string objectPath(const std::string &key) const;
+
+    unsigned hits() const {
+        return numHits;
+    }
+    unsigned misses() const {
+        return numMisses;
+    }
+
+  private:
+    // Creates a uniquely named file in the cache directory, which is renamed
+    // to the object's path once fully written
+    bool createTempFile(const std::string &key, llvm::SmallVectorImpl<char> &tempPath, int &fd);
+
+    std::string directory;
+    std::atomic<unsigned> numHits = 0;
+    std::atomic<unsigned> numMisses = 0;
+};
@@ -0,0 +1,7 @@
+// kopic-client, a minimal client for kopic --server. It doesn't link LLVM, so
+// it starts in a fraction of the time kopic --client takes.
+#include "remote.hpp"
+
+int main(int argc, char *argv[]) {
+    return remote::clientMain(argc, argv);
+}
@@ -0,0 +1,753 @@
+#include "codegen.hpp"
+
+#include <llvm/Analysis/ModuleSummaryAnalysis.h>
+#include <llvm/Analysis/ProfileSummaryInfo.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/OptimizationLevel.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Passes/StandardInstrumentations.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/PGOOptions.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <llvm/Support/raw_os_ostream.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/TargetParser/Host.h>
+#include <llvm/TargetParser/SubtargetFeature.h>
+#include <llvm/TargetParser/Triple.h>
+#include <llvm/Transforms/IPO/GlobalDCE.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#include "cache.hpp"
+
+static llvm::OptimizationLevel optimizationLevel(char level) {
+    switch (level) {
+    case '1':
+        return llvm::OptimizationLevel::O1;
+    case '2':
+        return llvm::OptimizationLevel::O2;
+    case '3':
+        return llvm::OptimizationLevel::O3;
+    case 's':
+        return llvm::OptimizationLevel::Os;
+    case 'z':
+        return llvm::OptimizationLevel::Oz;
+    default:
+        return llvm::OptimizationLevel::O0;
+    }
+}
+
+static llvm::CodeGenOptLevel codegenOptLevel(char level) {
+    switch (level) {
+    case '0':
+        return llvm::CodeGenOptLevel::None;
+    case '1':
+        return llvm::CodeGenOptLevel::Less;
+    case '3':
+        return llvm::CodeGenOptLevel::Aggressive;
+    default:
+        return llvm::CodeGenOptLevel::Default;
+    }
+}
+
+static void runOptimizationPipeline(llvm::Module &module, llvm::TargetMachine *machine,
+                                    const CodegenOptions &options) {
+    llvm::TimeTraceScope traceScope("Optimize", module.getName());
+    llvm::OptimizationLevel level = optimizationLevel(options.optLevel);
+
+    // Vectorize at the same levels as clang does
+    llvm::PipelineTuningOptions tuningOptions;
+    tuningOptions.LoopVectorization = level.getSpeedupLevel() > 1 && level != llvm::OptimizationLevel::Oz;
+    tuningOptions.SLPVectorization = tuningOptions.LoopVectorization;
+
+    llvm::LoopAnalysisManager loopAnalysis;
+    llvm::FunctionAnalysisManager functionAnalysis;
+    llvm::CGSCCAnalysisManager cgsccAnalysis;
+    llvm::ModuleAnalysisManager moduleAnalysis;
+
+    // Among others these add the passes to -ftime-trace
+    llvm::PassInstrumentationCallbacks instrumentation;
+    llvm::StandardInstrumentations standardInstrumentations(module.getContext(), /*DebugLogging=*/false);
+    standardInstrumentations.registerCallbacks(instrumentation, &moduleAnalysis);
+
+    // Instrumentation goes in early, before inlining, so that the profile
+    // still matches the functions as written when it's used
+    std::optional<llvm::PGOOptions> pgoOptions;
+    if (options.profileGenerate) {
+        pgoOptions = llvm::PGOOptions(options.profileGenerateFile, "", "", "", llvm::vfs::getRealFileSystem(),
+                                      llvm::PGOOptions::IRInstr);
+    } else if (!options.profileUse.empty()) {
+        pgoOptions = llvm::PGOOptions(options.profileUse, "", "", "", llvm::vfs::getRealFileSystem(),
+                                      llvm::PGOOptions::IRUse);
+    }
+
+    llvm::PassBuilder passBuilder(machine, tuningOptions, pgoOptions, &instrumentation);
+    passBuilder.registerModuleAnalyses(moduleAnalysis);
+    passBuilder.registerCGSCCAnalyses(cgsccAnalysis);
+    passBuilder.registerFunctionAnalyses(functionAnalysis);
+    passBuilder.registerLoopAnalyses(loopAnalysis);
+    passBuilder.crossRegisterProxies(loopAnalysis, functionAnalysis, cgsccAnalysis, moduleAnalysis);
+
+    llvm::ModulePassManager passManager;
+    if (level == llvm::OptimizationLevel::O0) {
+        passManager = passBuilder.buildO0DefaultPipeline(level, /*LTOPreLink=*/options.thinLTO);
+        // The other levels already drop private functions that are no
+        // longer called
+        passManager.addPass(llvm::GlobalDCEPass());
+    } else if (options.thinLTO) {
+        // Leaves out what is better done once the linker has seen every
+        // module, like most of the inlining and all of the vectorization
+        passManager = passBuilder.buildThinLTOPreLinkDefaultPipeline(level);
+    } else {
+        passManager = passBuilder.buildPerModuleDefaultPipeline(level);
+    }
+    passManager.run(module, moduleAnalysis);
+}
+
+static bool emitCode(llvm::Module &module, llvm::TargetMachine &machine, llvm::CodeGenFileType fileType,
+                     llvm::SmallVectorImpl<char> &object, std::ostream &diag) {
+    llvm::TimeTraceScope traceScope("Codegen", module.getName());
+    llvm::raw_svector_ostream os(object);
+    llvm::legacy::PassManager passManager;
+
+    if (machine.addPassesToEmitFile(passManager, os, nullptr, fileType)) {
+        diag << "Could not add " << (fileType == llvm::CodeGenFileType::ObjectFile ? "object" : "assembly")
+             << " file emit to pass manager" << std::endl;
+        return false;
+    }
+
+    passManager.run(module);
+    return true;
+}
+
+// With a module summary for ThinLTO, the linker can decide what to import
+// into each module without loading all of them
+static void writeBitcode(const llvm::Module &module, llvm::SmallVectorImpl<char> &bitcode, bool thinLTO) {
+    llvm::TimeTraceScope traceScope("WriteBitcode", module.getName());
+    llvm::raw_svector_ostream os(bitcode);
+    if (!thinLTO) {
+        llvm::WriteBitcodeToFile(module, os);
+        return;
+    }
+    llvm::ProfileSummaryInfo profileSummary(module);
+    llvm::ModuleSummaryIndex summary = llvm::buildModuleSummaryIndex(module, nullptr, &profileSummary);
+    llvm::WriteBitcodeToFile(module, os, /*ShouldPreserveUseListOrder=*/false, &summary, /*GenerateHash=*/true);
+}
+
+static bool writeObject(llvm::ArrayRef<char> object, const std::string &filename, std::ostream &diag) {
+    llvm::TimeTraceScope traceScope("WriteObject", filename);
+    std::error_code errCode;
+    llvm::raw_fd_ostream outfile(filename, errCode, llvm::sys::fs::OF_None);
+    if (errCode) {
+        diag << "Unable to open " << filename << ": " << errCode.message() << std::endl;
+        return false;
+    }
+
+    outfile.write(object.data(), object.size());
+    outfile.close();
+    if (outfile.has_error()) {
+        diag << "Unable to write " << filename << ": " << outfile.error().message() << std::endl;
+        outfile.clear_error();
+        return false;
+    }
+    return true;
+}
+
+bool linkRelocatable(const std::vector<std::string> &objects, const std::string &output, std::ostream &diag) {
+    auto linker = llvm::sys::findProgramByName("ld");
+    if (!linker) {
+        diag << "Unable to find ld to combine object files" << std::endl;
+        return false;
+    }
+
+    std::vector<llvm::StringRef> args = {"ld", "-r", "-o", output};
+    args.insert(args.end(), objects.begin(), objects.end());
+
+    std::string errorMsg;
+    if (llvm::sys::ExecuteAndWait(*linker, args, std::nullopt, {}, 0, 0, &errorMsg) != 0) {
+        diag << "Unable to combine object files into " << output << (errorMsg.empty() ? "" : ": ") << errorMsg
+             << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Registering targets takes a while, especially with a libLLVM that has every
+// backend built in, so only the host's target is registered unless the triple
+// is for something else. No assembly is parsed, so no asm parsers are needed.
+static void registerTarget(const llvm::Triple &triple) {
+    static std::once_flag nativeInitialized, allInitialized;
+    if (triple.getArch() == llvm::Triple(llvm::sys::getProcessTriple()).getArch()) {
+        std::call_once(nativeInitialized, []() {
+            llvm::InitializeNativeTarget();
+            llvm::InitializeNativeTargetAsmPrinter();
+        });
+    } else {
+        std::call_once(allInitialized, []() {
+            llvm::InitializeAllTargetInfos();
+            llvm::InitializeAllTargets();
+            llvm::InitializeAllTargetMCs();
+            llvm::InitializeAllAsmPrinters();
+        });
+    }
+}
+
+TargetDescription codegenResolveTarget(const CodegenOptions &options) {
+    TargetDescription desc;
+    desc.triple =
+        options.triple.empty() ? llvm::sys::getDefaultTargetTriple() : llvm::Triple::normalize(options.triple);
+    desc.cpu = options.cpu;
+
+    llvm::SubtargetFeatures features;
+    if (desc.cpu == "native") {
+        desc.cpu = llvm::sys::getHostCPUName().str();
+
+        // Sorted, so the same host always produces the same feature string
+        llvm::StringMap<bool> hostFeatures;
+        if (llvm::sys::getHostCPUFeatures(hostFeatures)) {
+            std::vector<std::string> hostFeatureNames;
+            for (const auto &feature : hostFeatures) {
+                hostFeatureNames.push_back((feature.second ? "+" : "-") + feature.first().str());
+            }
+            llvm::sort(hostFeatureNames);
+            for (const std::string &feature : hostFeatureNames) {
+                features.AddFeature(feature);
+            }
+        }
+    }
+    if (!options.features.empty()) {
+        llvm::SubtargetFeatures extraFeatures(options.features);
+        for (const std::string &feature : extraFeatures.getFeatures()) {
+            features.AddFeature(feature);
+        }
+    }
+    desc.features = features.getString();
+    return desc;
+}
+
+void codegenRegisterTarget(const CodegenOptions &options) {
+    registerTarget(llvm::Triple(codegenResolveTarget(options).triple));
+}
+
+namespace {
+
+// Target machines that aren't in use, by the target and options they were
+// created for. Setting one up parses the CPU's features and scheduling
+// model, which a server only wants to do once: it prepares machines before
+// forking its workers, which start out with copies of them. A single
+// compilation doesn't keep them, it is done by the time one could be reused.
+class TargetMachinePool {
+  public:
+    void enable() {
+        std::lock_guard<std::mutex> lock(mutex);
+        enabled = true;
+    }
+
+    std::unique_ptr<llvm::TargetMachine> take(const std::string &key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = idle.find(key);
+        if (it == idle.end() || it->second.empty())
+            return nullptr;
+        std::unique_ptr<llvm::TargetMachine> machine = std::move(it->second.back());
+        it->second.pop_back();
+        return machine;
+    }
+
+    // Machines are only used by one thread at a time, so there are as many
+    // for each key as there were compilations using it at the same time
+    void give(const std::string &key, std::unique_ptr<llvm::TargetMachine> machine) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (enabled && machine != nullptr)
+            idle[key].push_back(std::move(machine));
+    }
+
+  private:
+    std::mutex mutex;
+    bool enabled = false;
+    std::map<std::string, std::vector<std::unique_ptr<llvm::TargetMachine>>> idle;
+};
+
+} // namespace
+
+static TargetMachinePool targetMachinePool;
+
+void codegenReuseTargetMachines() {
+    targetMachinePool.enable();
+}
+
+CodegenContext::CodegenContext(const SourceBuffer &src, const CodegenOptions &options, PhaseTimers &timers)
+    : source(src), options(options), timers(timers) {
+}
+
+CodegenContext::~CodegenContext() {
+    targetMachinePool.give(targetMachineKey(), std::move(targetMachine));
+}
+
+// Whether the feature string turns the feature on, the last mention of it wins
+static bool hasFeature(const std::string &featureString, llvm::StringRef name) {
+    bool enabled = false;
+    llvm::SubtargetFeatures features(featureString);
+    for (const std::string &feature : features.getFeatures()) {
+        if (llvm::StringRef(feature).drop_front() == name)
+            enabled = feature[0] == '+';
+    }
+    return enabled;
+}
+
+bool CodegenContext::guaranteesTailCalls(unsigned argCount) const {
+    switch (llvm::Triple(target.triple).getArch()) {
+    case llvm::Triple::x86:
+    case llvm::Triple::x86_64:
+    case llvm::Triple::aarch64:
+    case llvm::Triple::aarch64_be:
+        return true;
+    case llvm::Triple::riscv32:
+    case llvm::Triple::riscv64:
+        // Only if no argument is passed on the stack, in a0-a7, or a0-a5 with
+        // the E extension
+        return argCount <= (hasFeature(target.features, "e") ? 6 : 8);
+    case llvm::Triple::wasm32:
+    case llvm::Triple::wasm64:
+        return hasFeature(target.features, "tail-call");
+    default:
+        return false;
+    }
+}
+
+// Everything that createTargetMachine() sets up the machine with
+static std::string targetMachineKey(const TargetDescription &target, const CodegenOptions &options) {
+    return target.triple + '\0' + target.cpu + '\0' + target.features + '\0' + options.optLevel
+           + (options.pic ? "pic" : "static");
+}
+
+static std::unique_ptr<llvm::TargetMachine> createTargetMachine(const TargetDescription &target,
+                                                                const CodegenOptions &options, std::ostream &diag) {
+    if (std::unique_ptr<llvm::TargetMachine> machine = targetMachinePool.take(targetMachineKey(target, options)))
+        return machine;
+
+    const std::string &targetTriple = target.triple;
+    registerTarget(llvm::Triple(targetTriple));
+
+    std::string errorMsg;
+    const llvm::Target *llvmTarget = llvm::TargetRegistry::lookupTarget(targetTriple, errorMsg);
+    if (llvmTarget == nullptr) {
+        diag << "Unable to look up target triple " << targetTriple << ": " << errorMsg << std::endl;
+        return nullptr;
+    }
+
+    llvm::TargetOptions targetOptions;
+    llvm::Reloc::Model relocModel = options.pic ? llvm::Reloc::PIC_ : llvm::Reloc::Static;
+    std::unique_ptr<llvm::TargetMachine> machine(llvmTarget->createTargetMachine(targetTriple, target.cpu,
+                                                                                 target.features, targetOptions,
+                                                                                 relocModel, std::nullopt,
+                                                                                 codegenOptLevel(options.optLevel)));
+    if (machine == nullptr) {
+        diag << "Unable to create target machine for " << targetTriple << std::endl;
+    }
+    return machine;
+}
+
+void codegenPrepareTargetMachine(const CodegenOptions &options) {
+    TargetDescription target = codegenResolveTarget(options);
+    targetMachinePool.give(targetMachineKey(target, options), createTargetMachine(target, options, std::cerr));
+}
+
+std::string CodegenContext::targetMachineKey() const {
+    return ::targetMachineKey(target, options);
+}
+
+std::unique_ptr<llvm::TargetMachine> CodegenContext::createTargetMachine() const {
+    return ::createTargetMachine(target, options, source.diagnostics());
+}
+
+bool CodegenContext::init() {
+    context = std::make_unique<llvm::LLVMContext>();
+    module = std::make_unique<llvm::Module>(source.name(), *context);
+    builder = std::make_unique<llvm::IRBuilder<>>(*context);
+    target = codegenResolveTarget(options);
+
+    module->setTargetTriple(target.triple);
+    if (options.pic) {
+        module->setPICLevel(llvm::PICLevel::BigPIC);
+    }
+
+    // Record what the object was built for in its .comment section, so that
+    // per-microarchitecture builds can be told apart
+    std::string ident = "kopic (target-cpu=" + target.cpu + ", target-features=" + target.features + ")";
+    module->getOrInsertNamedMetadata("llvm.ident")
+        ->addOperand(llvm::MDNode::get(*context, llvm::MDString::get(*context, ident)));
+
+    return true;
+}
+
+bool CodegenContext::initTarget() {
+    targetMachine = createTargetMachine();
+    if (targetMachine == nullptr)
+        return false;
+    module->setDataLayout(targetMachine->createDataLayout());
+    return true;
+}
+
+// Refers to the profile runtime, so that linking with it as a static library
+// pulls it in. LLVM leaves this out on Linux, where clang -fprofile-generate
+// passes -u__llvm_profile_runtime to the linker instead.
+static void addProfileRuntimeHook(llvm::Module &module) {
+    llvm::Type *int32Type = llvm::Type::getInt32Ty(module.getContext());
+    auto *runtime = new llvm::GlobalVariable(module, int32Type, /*isConstant=*/false,
+                                             llvm::GlobalValue::ExternalLinkage, nullptr, "__llvm_profile_runtime");
+    runtime->setVisibility(llvm::GlobalValue::HiddenVisibility);
+
+    auto *user = llvm::Function::Create(llvm::FunctionType::get(int32Type, false),
+                                        llvm::GlobalValue::LinkOnceODRLinkage, "__llvm_profile_runtime_user", module);
+    user->setVisibility(llvm::GlobalValue::HiddenVisibility);
+    user->addFnAttr(llvm::Attribute::NoInline);
+    user->addFnAttr(llvm::Attribute::NoProfile);
+    llvm::IRBuilder<> builder(llvm::BasicBlock::Create(module.getContext(), "entry", user));
+    builder.CreateRet(builder.CreateLoad(int32Type, runtime));
+    llvm::appendToUsed(module, {user});
+}
+
+bool CodegenContext::optimize() {
+    if (hadError())
+        return false;
+
+    {
+        llvm::TimeRegion timer(timers.get(PhaseTimers::Verify));
+        llvm::TimeTraceScope traceScope("Verify", source.name());
+        llvm::raw_os_ostream diag(source.diagnostics());
+        if (llvm::verifyModule(*module, &diag)) {
+            diag << "Generated invalid IR for " << source.name() << '\n';
+            return false;
+        }
+    }
+
+    if (!initTarget())
+        return false;
+    if (options.profileGenerate) {
+        addProfileRuntimeHook(*module);
+    }
+
+    // Partitions are optimized separately once the module is split up. The
+    // driver doesn't allow running or printing the module in that case.
+    if (options.parallelCodegen > 1)
+        return true;
+
+    llvm::TimeRegion timer(timers.get(PhaseTimers::Optimize));
+    runOptimizationPipeline(*module, targetMachine.get(), options);
+    return true;
+}
+
+void CodegenContext::printIR() {
+    module->print(llvm::outs(), nullptr);
+}
+
+bool CodegenContext::output(const std::string &filename) {
+    if (options.parallelCodegen > 1) {
+        // The partitions are optimized and compiled all at once
+        llvm::TimeRegion timer(timers.get(PhaseTimers::Codegen));
+        return outputParallel(filename);
+    }
+
+    llvm::SmallVector<char, 0> object;
+    {
+        llvm::TimeRegion timer(timers.get(PhaseTimers::Codegen));
+        switch (options.emit) {
+        case EmitKind::Object:
+        case EmitKind::Assembly: {
+            auto fileType = options.emit == EmitKind::Object ? llvm::CodeGenFileType::ObjectFile
+                                                             : llvm::CodeGenFileType::AssemblyFile;
+            if (!emitCode(*module, *targetMachine, fileType, object, source.diagnostics()))
+                return false;
+            break;
+        }
+        case EmitKind::Bitcode:
+            writeBitcode(*module, object, options.thinLTO);
+            break;
+        case EmitKind::IR: {
+            llvm::raw_svector_ostream os(object);
+            module->print(os, nullptr);
+            break;
+        }
+        }
+    }
+    llvm::TimeRegion timer(timers.get(PhaseTimers::WriteObject));
+    return writeObject(object, filename, source.diagnostics());
+}
+
+// Copies a function into a module of its own, along with declarations of the
+// functions it calls. Cloning the whole module for every function would make
+// compiling all of them quadratic in the number of functions. Private
+// functions it calls are copied along with it, since no other object can
+// refer to them.
+static std::unique_ptr<llvm::Module> extractFunction(const llvm::Function &function) {
+    const llvm::Module &source = *function.getParent();
+    auto part = std::make_unique<llvm::Module>(source.getModuleIdentifier(), function.getContext());
+    part->setSourceFileName(source.getSourceFileName());
+    part->setTargetTriple(source.getTargetTriple());
+    part->setDataLayout(source.getDataLayout());
+    // Among others, the PIC level and the profile summary of -fprofile-use,
+    // which decides what code generation treats as hot or cold
+    llvm::SmallVector<llvm::Module::ModuleFlagEntry, 4> flags;
+    source.getModuleFlagsMetadata(flags);
+    for (const llvm::Module::ModuleFlagEntry &flag : flags) {
+        part->addModuleFlag(flag.Behavior, flag.Key->getString(), flag.Val);
+    }
+    if (const llvm::NamedMDNode *ident = source.getNamedMetadata("llvm.ident")) {
+        llvm::NamedMDNode *partIdent = part->getOrInsertNamedMetadata("llvm.ident");
+        for (const llvm::MDNode *operand : ident->operands()) {
+            partIdent->addOperand(const_cast<llvm::MDNode *>(operand));
+        }
+    }
+
+    llvm::ValueToValueMapTy valueMap;
+    llvm::SmallVector<const llvm::Function *, 4> definitions = {&function};
+    for (size_t i = 0; i < definitions.size(); i++) {
+        const llvm::Function *definition = definitions[i];
+        llvm::Function *copy = llvm::Function::Create(definition->getFunctionType(), definition->getLinkage(),
+                                                      definition->getName(), *part);
+        copy->copyAttributesFrom(definition);
+        valueMap[definition] = copy;
+
+        for (const llvm::Instruction &inst : llvm::instructions(*definition)) {
+            for (const llvm::Value *operand : inst.operands()) {
+                const auto *callee = llvm::dyn_cast<llvm::Function>(operand);
+                if (callee == nullptr || valueMap.count(callee) || llvm::is_contained(definitions, callee))
+                    continue;
+                if (callee->hasLocalLinkage()) {
+                    definitions.push_back(callee);
+                    continue;
+                }
+                llvm::Function *declaration = llvm::Function::Create(
+                    callee->getFunctionType(), llvm::Function::ExternalLinkage, callee->getName(), *part);
+                declaration->copyAttributesFrom(callee);
+                valueMap[callee] = declaration;
+            }
+        }
+    }
+
+    for (const llvm::Function *definition : definitions) {
+        auto *copy = llvm::cast<llvm::Function>(valueMap[definition]);
+        auto copyArg = copy->arg_begin();
+        for (const llvm::Argument &arg : definition->args()) {
+            valueMap[&arg] = &*copyArg++;
+        }
+        llvm::SmallVector<llvm::ReturnInst *, 4> returns;
+        llvm::CloneFunctionInto(copy, definition, valueMap, llvm::CloneFunctionChangeType::DifferentModule, returns);
+    }
+    return part;
+}
+
+bool CodegenContext::outputIncremental(const std::string &filename, llvm::ArrayRef<IncrementalFunction> functions,
+                                       ObjectCache &cache) {
+    {
+        llvm::TimeRegion timer(timers.get(PhaseTimers::Codegen));
+        for (const IncrementalFunction &function : functions) {
+            if (!function.changed)
+                continue;
+
+            std::unique_ptr<llvm::Module> part = extractFunction(*module->getFunction(function.name));
+            llvm::SmallVector<char, 0> object;
+            if (!emitCode(*part, *targetMachine, llvm::CodeGenFileType::ObjectFile, object, source.diagnostics()))
+                return false;
+            if (!cache.store(function.key, object)) {
+                source.diagnostics() << "Unable to store the object of " << function.name << " in the cache"
+                                     << std::endl;
+                return false;
+            }
+        }
+    }
+
+    llvm::TimeRegion timer(timers.get(PhaseTimers::WriteObject));
+    std::vector<std::string> objects;
+    for (const IncrementalFunction &function : functions) {
+        objects.push_back(cache.objectPath(function.key));
+    }
+    return linkRelocatable(objects, filename, source.diagnostics());
+}
+
+size_t CodegenContext::instructionCount() const {
+    size_t count = 0;
+    for (const llvm::Function &func : *module) {
+        count += func.getInstructionCount();
+    }
+    return count;
+}
+
+bool CodegenContext::outputParallel(const std::string &filename) {
+    // Partitions can't share an LLVMContext between threads, so each one is
+    // passed as bitcode to a thread that loads it into a context of its own
+    std::vector<llvm::SmallString<0>> partitions;
+    llvm::SplitModule(
+        *module, options.parallelCodegen,
+        [&partitions](std::unique_ptr<llvm::Module> partition) {
+            llvm::raw_svector_ostream os(partitions.emplace_back());
+            llvm::WriteBitcodeToFile(*partition, os);
+        },
+        /*PreserveLocals=*/true);
+
+    std::vector<std::string> partFiles(partitions.size());
+    std::vector<std::string> partErrors(partitions.size());
+    std::vector<char> partSucceeded(partitions.size(), false);
+
+    llvm::ThreadPool pool(llvm::hardware_concurrency(options.parallelCodegen));
+    for (size_t i = 0; i < partitions.size(); i++) {
+        pool.async([this, i, &partitions, &partFiles, &partErrors, &partSucceeded]() {
+            ThreadTimeTrace trace;
+            std::ostringstream diag;
+            llvm::LLVMContext partContext;
+            auto partModule = llvm::parseBitcodeFile(
+                llvm::MemoryBufferRef(llvm::StringRef(partitions[i].data(), partitions[i].size()), "partition"),
+                partContext);
+            if (!partModule) {
+                partErrors[i] = llvm::toString(partModule.takeError());
+                return;
+            }
+
+            llvm::SmallString<128> partPath;
+            if (llvm::sys::fs::createTemporaryFile("kopic-part", "o", partPath)) {
+                partErrors[i] = "Unable to create temporary object file";
+                return;
+            }
+            partFiles[i] = std::string(partPath);
+
+            // TargetMachines can't be shared between threads either. Errors
+            // go to the partition's own stream, which is printed once every
+            // partition is done.
+            std::unique_ptr<llvm::TargetMachine> partMachine = ::createTargetMachine(target, options, diag);
+            if (partMachine != nullptr) {
+                runOptimizationPipeline(**partModule, partMachine.get(), options);
+                llvm::SmallVector<char, 0> object;
+                partSucceeded[i] =
+                    emitCode(**partModule, *partMachine, llvm::CodeGenFileType::ObjectFile, object, diag)
+                    && writeObject(object, partFiles[i], diag);
+            }
+            partErrors[i] = diag.str();
+            targetMachinePool.give(::targetMachineKey(target, options), std::move(partMachine));
+        });
+    }
+    pool.wait();
+
+    bool succeeded = true;
+    for (size_t i = 0; i < partitions.size(); i++) {
+        source.diagnostics() << partErrors[i];
+        succeeded = succeeded && partSucceeded[i];
+    }
+    if (succeeded) {
+        succeeded = linkRelocatable(partFiles, filename, source.diagnostics());
+    }
+
+    for (const auto &partFile : partFiles) {
+        if (!partFile.empty())
+            llvm::sys::fs::remove(partFile);
+    }
+    return succeeded;
+}
+
+bool CodegenContext::checkEntry(const std::string &entry, size_t argCount) {
+    llvm::Function *entryFunc = module->getFunction(entry);
+    if (entryFunc == nullptr || entryFunc->isDeclaration()) {
+        source.diagnostics() << "No function named " << entry << " to run" << std::endl;
+        return false;
+    }
+    // The entry point is called through a pointer to a C function, which a
+    // private function isn't, and the optimizer is free to drop it
+    if (entryFunc->hasLocalLinkage() || entryFunc->getCallingConv() != llvm::CallingConv::C ||
+        entryFunc->getVisibility() != llvm::GlobalValue::DefaultVisibility) {
+        source.diagnostics() << entry << " is " << (entryFunc->hasLocalLinkage() ? "private" : "protected")
+                             << ", only public functions can be run" << std::endl;
+        return false;
+    }
+    if (entryFunc->arg_size() != argCount) {
+        source.diagnostics() << entry << " takes " << entryFunc->arg_size() << " arguments, but " << argCount
+                             << " were given" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool CodegenContext::run(const std::string &entry, llvm::ArrayRef<int> args, int *result) {
+
+    llvm::raw_os_ostream diag(source.diagnostics());
+
+    // Compile for the same CPU and features as object files would be
+    llvm::orc::JITTargetMachineBuilder machineBuilder(targetMachine->getTargetTriple());
+    machineBuilder.setCPU(targetMachine->getTargetCPU().str());
+    machineBuilder.addFeatures({targetMachine->getTargetFeatureString().str()});
+    machineBuilder.setCodeGenOptLevel(codegenOptLevel(options.optLevel));
+
+    auto jit = llvm::orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(machineBuilder)).create();
+    if (!jit) {
+        llvm::logAllUnhandledErrors(jit.takeError(), diag, "Unable to create JIT: ");
+        return false;
+    }
+
+    auto hostSymbols =
+        llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess((*jit)->getDataLayout().getGlobalPrefix());
+    if (!hostSymbols) {
+        llvm::logAllUnhandledErrors(hostSymbols.takeError(), diag, "Unable to load host symbols: ");
+        return false;
+    }
+    (*jit)->getMainJITDylib().addGenerator(std::move(*hostSymbols));
+
+    llvm::orc::ThreadSafeModule threadSafeModule(std::move(module), std::move(context));
+    if (auto err = (*jit)->addIRModule(std::move(threadSafeModule))) {
+        llvm::logAllUnhandledErrors(std::move(err), diag, "Unable to add module to JIT: ");
+        return false;
+    }
+
+    // Looking up the entry point is what compiles the module
+    auto compileStart = std::chrono::steady_clock::now();
+    auto entryOrErr = (*jit)->lookup(entry);
+    if (!entryOrErr) {
+        llvm::logAllUnhandledErrors(entryOrErr.takeError(), diag, "Unable to compile: ");
+        return false;
+    }
+    void *entryPoint = entryOrErr->toPtr<void *>();
+
+    auto runStart = std::chrono::steady_clock::now();
+    switch (args.size()) {
+    case 0:
+        *result = reinterpret_cast<int (*)()>(entryPoint)();
+        break;
+    case 1:
+        *result = reinterpret_cast<int (*)(int)>(entryPoint)(args[0]);
+        break;
+    case 2:
+        *result = reinterpret_cast<int (*)(int, int)>(entryPoint)(args[0], args[1]);
+        break;
+    case 3:
+        *result = reinterpret_cast<int (*)(int, int, int)>(entryPoint)(args[0], args[1], args[2]);
+        break;
+    case 4:
+        *result = reinterpret_cast<int (*)(int, int, int, int)>(entryPoint)(args[0], args[1], args[2], args[3]);
+        break;
+    default:
+        source.diagnostics() << "Running functions with more than 4 arguments is not supported" << std::endl;
+        return false;
+    }
+    auto runEnd = std::chrono::steady_clock::now();
+
+    using Millis = std::chrono::duration<double, std::milli>;
+    source.diagnostics() << "JIT compile: " << Millis(runStart - compileStart).count() << " ms, execution: "
+                         << Millis(runEnd - runStart).count() << " ms" << std::endl;
+    return true;
+}
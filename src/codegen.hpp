@@ -0,0 +1,168 @@
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "scope.hpp"
+#include "ssa.hpp"
+#include "timing.hpp"
+#include "token.hpp"
+
+// What is written to the output file
+enum class EmitKind {
+    Object,
+    Assembly,
+    Bitcode,
+    IR,
+};
+
+struct CodegenOptions {
+    // Optimization level as given to -O: '0', '1', '2', '3', 's' or 'z'
+    char optLevel = '0';
+    // Target triple, the host's if empty
+    std::string triple;
+    // CPU name or "native" for the host CPU, along with its features
+    std::string cpu = "generic";
+    // Comma separated list of features to add to the CPU's, e.g. "+avx2,-bmi"
+    std::string features;
+    bool pic = false;
+    // Split the module into this many partitions that are optimized and
+    // compiled on their own threads
+    unsigned parallelCodegen = 1;
+    EmitKind emit = EmitKind::Object;
+    // Optimize for ThinLTO and write bitcode with a module summary, so the
+    // linker can optimize across the objects of Kopi and other languages
+    bool thinLTO = false;
+    // Instrument the code to count how often each function and branch runs.
+    // The counts are written to profileGenerateFile when the program exits,
+    // or to the runtime's default if it's empty.
+    bool profileGenerate = false;
+    std::string profileGenerateFile;
+    // Indexed profile from llvm-profdata to optimize with, if set
+    std::string profileUse;
+};
+
+// The target triple, CPU and features that code will actually be generated
+// for, with "native" resolved to the host CPU.
+struct TargetDescription {
+    std::string triple;
+    std::string cpu;
+    std::string features;
+};
+
+TargetDescription codegenResolveTarget(const CodegenOptions &options);
+
+// Sets up the backend for the target in the options ahead of time, instead of
+// when the first module needs it
+void codegenRegisterTarget(const CodegenOptions &options);
+
+// Keeps the target machines of finished compilations for later ones with the
+// same target and options, for a server that compiles many files
+void codegenReuseTargetMachines();
+// Sets up an idle target machine for the options ahead of time, once reuse is
+// enabled
+void codegenPrepareTargetMachine(const CodegenOptions &options);
+
+// Combines object files into one relocatable object with the system linker
+bool linkRelocatable(const std::vector<std::string> &objects, const std::string &output, std::ostream &diag);
+
+class FuncASTNode;
+class ObjectCache;
+
+// A function compiled to an object of its own by -fincremental. Only changed
+// functions have a body in the module, the others are already in the cache.
+// Private functions have no object of their own, they are copied into the
+// objects of their callers.
+struct IncrementalFunction {
+    std::string name;
+    std::string key;
+    bool changed;
+};
+
+// Everything needed to generate code for one source file. Each context owns
+// its own LLVMContext, so several files can be compiled on different threads
+// at the same time.
+class CodegenContext {
+  public:
+    CodegenContext(const SourceBuffer &src, const CodegenOptions &options, PhaseTimers &timers);
+    ~CodegenContext();
+
+    // Sets up an empty module. The backend is only set up by optimize(), so
+    // front end only runs never touch it.
+    bool init();
+    // Verifies the module and runs the IR optimization pipeline for the
+    // optimization level in the options.
+    bool optimize();
+    void printIR();
+    bool output(const std::string &filename);
+    // Compiles each changed function into an object of its own and adds it to
+    // the cache, then links the objects of all functions into the output
+    bool outputIncremental(const std::string &filename, llvm::ArrayRef<IncrementalFunction> functions,
+                           ObjectCache &cache);
+    // Checks that the entry point for run() is a public function taking that
+    // many arguments. Must be called before optimize(), which may drop or
+    // change the calling convention of the other functions.
+    bool checkEntry(const std::string &entry, size_t argCount);
+    // JIT compiles the module in-process and calls the given entry point with
+    // integer arguments. Symbols of the host process, like libc, are available
+    // to the module. The module can not be used any further afterwards.
+    bool run(const std::string &entry, llvm::ArrayRef<int> args, int *result);
+
+    // Whether the backend for the target turns every musttail call between
+    // functions of the same type, with this many arguments, into a jump.
+    // Other backends stop with a fatal error on musttail calls they can't
+    // lower.
+    bool guaranteesTailCalls(unsigned argCount) const;
+
+    // Reports an error in the source file. The compilation fails once any
+    // error has been reported.
+    std::ostream &error(uint32_t offset) {
+        errorCount++;
+        return source.error(offset);
+    }
+    bool hadError() const {
+        return errorCount > 0;
+    }
+
+    // Number of IR instructions in the module as it currently is
+    size_t instructionCount() const;
+
+    std::string_view text(const Token &tok) const {
+        return source.text(tok);
+    }
+
+    const SourceBuffer &source;
+    const CodegenOptions options;
+    TargetDescription target;
+
+    std::unique_ptr<llvm::LLVMContext> context;
+    std::unique_ptr<llvm::Module> module;
+    std::unique_ptr<llvm::IRBuilder<>> builder;
+    // Null until optimize() is called
+    std::unique_ptr<llvm::TargetMachine> targetMachine;
+
+    // The function whose body is being emitted
+    const FuncASTNode *function = nullptr;
+    // Parameters and local variables, whose values are kept in SSA form
+    ScopedSymbolTable<std::optional<SSABuilder::Variable>> variables;
+    SSABuilder ssa;
+
+  private:
+    bool initTarget();
+    // Takes a machine left by an earlier compilation if there is one
+    std::unique_ptr<llvm::TargetMachine> createTargetMachine() const;
+    std::string targetMachineKey() const;
+    bool outputParallel(const std::string &filename);
+
+    PhaseTimers &timers;
+    unsigned errorCount = 0;
+};
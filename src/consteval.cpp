@@ -0,0 +1,41 @@
+#include "consteval.hpp"
+
+bool ConstEvaluator::call(Symbol function, llvm::ArrayRef<int32_t> args, int32_t *result) {
+    const FuncASTNode *func = functions.lookup(function);
+    if (func == nullptr || func->paramCount() != args.size())
+        return false;
+
+    auto key = std::make_pair(func, std::vector<int32_t>(args.begin(), args.end()));
+    auto cached = results.find(key);
+    if (cached != results.end()) {
+        if (!cached->second)
+            return false;
+        *result = *cached->second;
+        return true;
+    }
+    if (depth >= maxDepth)
+        return false;
+
+    // Calls made while folding each get a fresh budget, nested calls share it
+    bool outermost = depth == 0;
+    if (outermost)
+        steps = 0;
+
+    depth++;
+    bool succeeded = func->evaluate(*this, args, result);
+    depth--;
+
+    // A nested call may only have failed because the outermost one ran out of
+    // budget, so only its successes are remembered
+    if (succeeded) {
+        results[key] = *result;
+    } else if (outermost) {
+        results[key] = std::nullopt;
+    }
+    return succeeded;
+}
+
+ExprASTNode *ConstEvaluator::constant(Token origin, int32_t value) {
+    numFolded++;
+    return arena.make<NumericExprASTNode>(origin, value);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+
+#include <map>
+#include <optional>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "ast.hpp"
+#include "scope.hpp"
+#include "token.hpp"
+
+// Folds constant expressions before codegen and evaluates calls with constant
+// arguments by interpreting the callee. Kopi functions only compute on their
+// arguments, so any call can be evaluated early; calls that don't finish
+// within a fixed budget are left to run at runtime.
+class ConstEvaluator {
+  public:
+    ConstEvaluator(const SourceBuffer &source, ASTArena &arena) : source(source), arena(arena) {
+    }
+
+    // Reports an error in the source file, the compilation fails once any
+    // error has been reported
+    std::ostream &error(uint32_t offset) {
+        errorCount++;
+        return source.error(offset);
+    }
+    bool hadError() const {
+        return errorCount > 0;
+    }
+
+    // Makes the function available to calls being evaluated
+    void define(const FuncASTNode *func) {
+        functions.try_emplace(func->name(), func);
+    }
+    // The definition that calls to the function go to, or null if there is none
+    const FuncASTNode *function(Symbol name) const {
+        return functions.lookup(name);
+    }
+    // Returns false if the call can't be evaluated at compile time
+    bool call(Symbol function, llvm::ArrayRef<int32_t> args, int32_t *result);
+    // Creates the literal that replaces a folded expression
+    ExprASTNode *constant(Token origin, int32_t value);
+
+    // Counts one step of evaluation, returns false once the budget is used up
+    bool step() {
+        return ++steps <= maxSteps;
+    }
+
+    // Set by a return statement, ends execution of the function being evaluated
+    void setReturnValue(int32_t value) {
+        returnValue = value;
+    }
+    bool returned() const {
+        return returnValue.has_value();
+    }
+    std::optional<int32_t> takeReturnValue() {
+        return std::exchange(returnValue, std::nullopt);
+    }
+
+    size_t foldedCount() const {
+        return numFolded;
+    }
+
+    // Calls are recorded while folding, since the code generated for a
+    // function depends on the bodies of the functions it calls with constant
+    // arguments, and through them on everything they call
+    void startFolding(const FuncASTNode *func) {
+        folding = func;
+    }
+    void noteCall(Symbol function) {
+        calls[folding].push_back(function);
+    }
+    // Functions called by the function, in the order of the calls
+    llvm::ArrayRef<Symbol> callees(const FuncASTNode *func) const {
+        auto it = calls.find(func);
+        return it == calls.end() ? llvm::ArrayRef<Symbol>() : llvm::ArrayRef<Symbol>(it->second);
+    }
+
+    // Variables of the functions being evaluated, the innermost call is in
+    // the topmost scopes. Unbound and not yet initialized variables are nullopt.
+    ScopedSymbolTable<std::optional<int32_t>> variables;
+
+  private:
+    static constexpr unsigned maxSteps = 1 << 16;
+    static constexpr unsigned maxDepth = 64;
+
+    const SourceBuffer &source;
+    ASTArena &arena;
+    unsigned errorCount = 0;
+
+    llvm::DenseMap<Symbol, const FuncASTNode *> functions;
+    // Results of earlier calls, nullopt if the call couldn't be evaluated
+    std::map<std::pair<const FuncASTNode *, std::vector<int32_t>>, std::optional<int32_t>> results;
+    llvm::DenseMap<const FuncASTNode *, llvm::SmallVector<Symbol, 4>> calls;
+    const FuncASTNode *folding = nullptr;
+
+    std::optional<int32_t> returnValue;
+    unsigned steps = 0;
+    unsigned depth = 0;
+    size_t numFolded = 0;
+};
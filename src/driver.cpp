@@ -0,0 +1,256 @@
+#include "driver.hpp"
+
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/TimeProfiler.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+#include "ast.hpp"
+#include "cache.hpp"
+#include "consteval.hpp"
+#include "parser.hpp"
+#include "timing.hpp"
+
+std::string defaultOutputName(const std::string &input, EmitKind emit) {
+    const char *extensions[] = {".o", ".s", ".bc", ".ll"};
+    const char *extension = extensions[static_cast<int>(emit)];
+    if (input == "-")
+        return std::string("a") + extension;
+    return std::filesystem::path(input).stem().concat(extension).string();
+}
+
+// Keys of the functions of the file for -fincremental. A function's key covers
+// its own definition, and those of every function reachable through its calls,
+// which constant evaluation may have folded into its code.
+static std::vector<std::string> functionKeys(const SourceBuffer &source, const SourceFileASTNode &ast,
+                                             const ConstEvaluator &evaluator, const CodegenOptions &options) {
+    llvm::ArrayRef<FuncASTNode *> functions = ast.definitions();
+    llvm::DenseMap<const FuncASTNode *, size_t> indices;
+    std::vector<llvm::StringRef> definitions;
+    for (size_t i = 0; i < functions.size(); i++) {
+        // Everything up to the next definition, so edits to the comments and
+        // whitespace that follow a function count as edits to the function
+        const char *begin = source.begin() + functions[i]->sourceBegin();
+        const char *end = i + 1 < functions.size() ? source.begin() + functions[i + 1]->sourceBegin() : source.end();
+        definitions.emplace_back(begin, end - begin);
+        indices[functions[i]] = i;
+    }
+
+    std::string optionsKey = ObjectCache::key("", options);
+    std::vector<std::string> keys;
+    std::vector<size_t> visitedBy(functions.size(), SIZE_MAX);
+    for (size_t i = 0; i < functions.size(); i++) {
+        std::vector<size_t> reachable;
+        std::vector<size_t> stack = {i};
+        visitedBy[i] = i;
+        while (!stack.empty()) {
+            size_t current = stack.back();
+            stack.pop_back();
+            for (Symbol callee : evaluator.callees(functions[current])) {
+                auto it = indices.find(evaluator.function(callee));
+                if (it != indices.end() && visitedBy[it->second] != i) {
+                    visitedBy[it->second] = i;
+                    reachable.push_back(it->second);
+                    stack.push_back(it->second);
+                }
+            }
+        }
+        llvm::sort(reachable);
+
+        std::vector<llvm::StringRef> dependencies = {definitions[i]};
+        for (size_t index : reachable) {
+            dependencies.push_back(definitions[index]);
+        }
+        keys.push_back(ObjectCache::functionKey(dependencies, optionsKey));
+    }
+    return keys;
+}
+
+void compileFile(CompileJob &job, const DriverOptions &options) {
+    ThreadTimeTrace trace;
+    llvm::TimeTraceScope traceScope("CompileFile", job.input);
+    std::ostringstream diag;
+
+    SourceBuffer source(diag);
+    if (!source.open(job.input)) {
+        job.diagnostics = diag.str();
+        return;
+    }
+
+    if (options.printStats) {
+        diag << "=== kopic statistics: " << source.name() << " ===\n";
+    }
+
+    // Dumps and JIT runs need the whole pipeline to run and syntax checks
+    // don't produce an object, so they can't be served from the cache
+    std::string cacheKey;
+    if (options.cache != nullptr && !options.run && !options.syntaxOnly && !options.dumpAst && !options.dumpIr) {
+        cacheKey = ObjectCache::key(llvm::StringRef(source.begin(), source.end() - source.begin()), options.codegen);
+        bool hit = options.cache->fetch(cacheKey, job.output);
+        if (options.printStats) {
+            diag << "cache.hit " << hit << '\n';
+        }
+        if (hit) {
+            job.succeeded = true;
+            job.diagnostics = diag.str();
+            return;
+        }
+    }
+
+    PhaseTimers timers(options.timeReport);
+
+    if (options.timeReport) {
+        // Timing every token as the parser pulls it in would cost more than
+        // lexing it, so lexing gets timed in a pass of its own
+        llvm::TimeRegion timer(timers.get(PhaseTimers::Lex));
+        StringTable lexStrings;
+        TokenReader lexer(source, lexStrings);
+        while (lexer.next().type != TokenType::EoF) {
+        }
+    }
+
+    StringTable strings;
+    TokenReader tokenizer(source, strings);
+    ASTArena arena;
+    SourceFileASTNode *ast;
+    {
+        llvm::TimeRegion timer(timers.get(PhaseTimers::Parse));
+        llvm::TimeTraceScope traceScope("Parse", source.name());
+        ast = parse(tokenizer, arena);
+    }
+    if (options.printStats) {
+        diag << "tokens.lexed " << tokenizer.tokensLexed() << '\n';
+        diag << "tokens.consumed " << tokenizer.tokensConsumed() << '\n';
+        diag << "symbols " << strings.size() << '\n';
+        diag << "ast.nodes " << arena.nodeCount() << '\n';
+        diag << "ast.bytes " << arena.bytesAllocated() << '\n';
+    }
+
+    if (ast != nullptr) {
+        if (options.dumpAst) {
+            ast->dbgprint(source, 0);
+        }
+
+        ConstEvaluator evaluator(source, arena);
+        {
+            llvm::TimeRegion timer(timers.get(PhaseTimers::ConstEval));
+            llvm::TimeTraceScope traceScope("ConstEval", source.name());
+            ast->fold(evaluator);
+        }
+        if (options.printStats) {
+            diag << "consteval.folded " << evaluator.foldedCount() << '\n';
+        }
+
+        // Files without functions produce an empty object, there's nothing to
+        // link
+        std::vector<IncrementalFunction> incremental;
+        llvm::BitVector changed;
+        if (!cacheKey.empty() && options.incremental && !evaluator.hadError() && !ast->definitions().empty()) {
+            std::vector<std::string> keys = functionKeys(source, *ast, evaluator, options.codegen);
+            changed.resize(keys.size());
+            for (size_t i = 0; i < keys.size(); i++) {
+                // Private functions end up in the objects of their callers,
+                // whose keys cover them
+                const FuncASTNode *func = ast->definitions()[i];
+                if (func->visibility() == Visibility::Private)
+                    continue;
+                changed[i] = !options.cache->contains(keys[i]);
+                incremental.push_back({strings.name(func->name()).str(), keys[i], changed[i]});
+            }
+            if (options.printStats) {
+                diag << "incremental.compiled " << changed.count() << '\n';
+                diag << "incremental.reused " << incremental.size() - changed.count() << '\n';
+            }
+        }
+
+        CodegenContext codegen(source, options.codegen, timers);
+        if (!evaluator.hadError() && codegen.init()) {
+            {
+                llvm::TimeRegion timer(timers.get(PhaseTimers::Emit));
+                llvm::TimeTraceScope traceScope("Emit", source.name());
+                if (incremental.empty()) {
+                    ast->emit(codegen);
+                } else {
+                    ast->emitSelected(codegen, changed);
+                }
+            }
+            if (options.printStats && !codegen.hadError()) {
+                diag << "ir.instructions " << codegen.instructionCount() << '\n';
+            }
+            if (options.syntaxOnly) {
+                job.succeeded = !codegen.hadError();
+            } else if ((!options.run || codegen.checkEntry(options.runEntry, options.runArgs.size())) &&
+                       codegen.optimize()) {
+                // Partitions of -fparallel-codegen are optimized later on
+                if (options.printStats && options.codegen.parallelCodegen <= 1) {
+                    diag << "ir.instructions.optimized " << codegen.instructionCount() << '\n';
+                }
+                if (options.dumpIr) {
+                    codegen.printIR();
+                }
+
+                if (options.run) {
+                    job.succeeded = codegen.run(options.runEntry, options.runArgs, &job.runResult);
+                } else {
+                    job.succeeded = incremental.empty()
+                                        ? codegen.output(job.output)
+                                        : codegen.outputIncremental(job.output, incremental, *options.cache);
+                    if (job.succeeded && !cacheKey.empty()) {
+                        options.cache->store(cacheKey, job.output);
+                    }
+                    uint64_t objectSize;
+                    if (job.succeeded && options.printStats && !llvm::sys::fs::file_size(job.output, objectSize)) {
+                        diag << "object.bytes " << objectSize << '\n';
+                    }
+                }
+            }
+        }
+    }
+
+    if (options.printStats) {
+        timers.printStats(diag);
+    }
+    timers.print(diag);
+    job.diagnostics = diag.str();
+}
+
+bool compileAll(std::vector<CompileJob> &jobs, const DriverOptions &options, unsigned threads) {
+    // Dumps go straight to stdout, so keep them in order
+    if (options.dumpAst || options.dumpIr)
+        threads = 1;
+
+    std::mutex outputMutex;
+    auto compileJob = [&options, &outputMutex](CompileJob &job) {
+        compileFile(job, options);
+
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cerr << job.diagnostics << std::flush;
+    };
+
+    if (threads <= 1 || jobs.size() == 1) {
+        for (auto &job : jobs) {
+            compileJob(job);
+        }
+    } else {
+        llvm::ThreadPool pool(llvm::hardware_concurrency(threads));
+        for (auto &job : jobs) {
+            pool.async(compileJob, std::ref(job));
+        }
+        pool.wait();
+    }
+
+    for (const auto &job : jobs) {
+        if (!job.succeeded)
+            return false;
+    }
+    return true;
+}
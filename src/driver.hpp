@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "codegen.hpp"
+
+class ObjectCache;
+
+inline constexpr const char *kopicVersion = "0.1.0";
+
+struct DriverOptions {
+    CodegenOptions codegen;
+    bool dumpAst = false;
+    bool dumpIr = false;
+    // Stop once the input is checked for errors, before the backend is needed
+    bool syntaxOnly = false;
+    bool printStats = false;
+    // Print how long each phase took, for -ftime-report
+    bool timeReport = false;
+
+    // Run the program in-process with the JIT instead of writing an object
+    bool run = false;
+    std::string runEntry = "main";
+    std::vector<int> runArgs;
+
+    // Reuse and store object files here, if set
+    ObjectCache *cache = nullptr;
+    // Keep an object for every function in the cache, so only functions that
+    // changed are compiled again
+    bool incremental = false;
+};
+
+// One source file to compile, and the outcome of compiling it
+struct CompileJob {
+    std::string input;
+    std::string output;
+
+    bool succeeded = false;
+    // Return value of the entry point when running with the JIT
+    int runResult = 0;
+    std::string diagnostics;
+};
+
+// Output file name used when none is given, placed in the working directory
+std::string defaultOutputName(const std::string &input, EmitKind emit);
+
+// Lexes, parses and generates code for a single file. Diagnostics are
+// collected into the job instead of being printed.
+void compileFile(CompileJob &job, const DriverOptions &options);
+
+// Compiles every job on a pool of up to the given number of threads, and
+// prints the diagnostics of each job as soon as it finishes. Returns false if
+// any job failed.
+bool compileAll(std::vector<CompileJob> &jobs, const DriverOptions &options, unsigned threads);
@@ -1,61 +1,363 @@
-#include "parser.hpp"
+#include "cache.hpp"
+#include "driver.hpp"
+#include "remote.hpp"
+#include "timing.hpp"
 
+#include <llvm/ADT/Statistic.h>
+#include <llvm/ADT/StringExtras.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Threading.h>
 
-#include <filesystem>
-#include <fstream>
+#include <algorithm>
 #include <iostream>
 
+#include <sys/resource.h>
+
 using namespace llvm;
 
 cl::OptionCategory category("kopic options");
 
-cl::opt<std::string> inputName(cl::Positional, cl::desc("<input file>"), cl::Required, cl::cat(category));
-cl::opt<std::string> outputName("o", cl::desc("Specify output filename"), cl::value_desc("filename"),
-                                cl::cat(category));
+// Every option has a cl::init, even when it's the type's default, since the
+// server resets options to their defaults before each request and options
+// without one keep the value the server was started with
+cl::list<std::string> inputNames(cl::Positional, cl::desc("<input files, or - for stdin>"), cl::ZeroOrMore,
+                                 cl::cat(category));
+cl::opt<std::string> outputName("o", cl::desc("Specify output filename, only allowed with a single input"),
+                                cl::value_desc("filename"), cl::init(""), cl::cat(category));
+cl::opt<unsigned> jobs("j", cl::desc("Number of files to compile in parallel (default 1, 0 for one per core)"),
+                       cl::value_desc("N"), cl::Prefix, cl::init(1), cl::cat(category));
 
-cl::opt<bool> dumpAst("dump-ast", cl::desc("Print AST to stdout"), cl::cat(category));
-cl::opt<bool> dumpIr("dump-ir", cl::desc("Print LLVM IR to stdout"), cl::cat(category));
+cl::opt<char> optLevel("O", cl::desc("Optimization level: -O0, -O1, -O2, -O3, -Os or -Oz (default -O0)"),
+                       cl::Prefix, cl::init('0'), cl::cat(category));
 
-int main(int argc, char *argv[]) {
-    cl::HideUnrelatedOptions(category);
-    cl::ParseCommandLineOptions(argc, argv);
+cl::opt<std::string> targetTriple("mtriple", cl::desc("Generate code for this target triple (default the host's)"),
+                                  cl::value_desc("triple"), cl::init(""), cl::cat(category));
+cl::opt<std::string> targetCpu("mcpu", cl::desc("Target a specific CPU, or native for the host CPU"),
+                               cl::value_desc("cpu-name"), cl::init("generic"), cl::cat(category));
+cl::list<std::string> targetFeatures("mattr", cl::CommaSeparated,
+                                     cl::desc("Target specific attributes (e.g. +avx2,-fma)"),
+                                     cl::value_desc("a1,+a2,-a3,..."), cl::cat(category));
+cl::opt<std::string> targetArch("march", cl::desc("Same as -mcpu, -march=native targets the host CPU and its features"),
+                                cl::value_desc("cpu-name"), cl::init(""), cl::cat(category));
+cl::opt<bool> pic("fPIC", cl::desc("Generate position independent code"), cl::init(false), cl::cat(category));
+cl::opt<unsigned> parallelCodegen("fparallel-codegen",
+                                  cl::desc("Split each module into N partitions that are optimized and compiled "
+                                           "in parallel (default 1)"),
+                                  cl::value_desc("N"), cl::init(1), cl::cat(category));
+
+cl::opt<EmitKind> emitKind("emit", cl::desc("Kind of output file to write (default obj)"),
+                           cl::values(clEnumValN(EmitKind::Object, "obj", "Native object file"),
+                                      clEnumValN(EmitKind::Assembly, "asm", "Native assembly"),
+                                      clEnumValN(EmitKind::Bitcode, "bc", "LLVM bitcode"),
+                                      clEnumValN(EmitKind::IR, "ll", "LLVM IR as text")),
+                           cl::init(EmitKind::Object), cl::cat(category));
+cl::opt<std::string> lto("flto",
+                         cl::desc("Write ThinLTO bitcode, for clang or lld to optimize together with the other "
+                                  "objects at link time"),
+                         cl::value_desc("thin"), cl::init(""), cl::cat(category));
+
+cl::opt<std::string> profileGenerate("fprofile-generate", cl::ValueOptional,
+                                     cl::desc("Instrument the code to write a profile of how it runs to this file, "
+                                              "link with runtime/libkopiprofile.a"),
+                                     cl::value_desc("filename"), cl::init(""), cl::cat(category));
+cl::opt<std::string> profileUse("fprofile-use", cl::desc("Optimize with a profile merged by llvm-profdata"),
+                                cl::value_desc("file.profdata"), cl::init(""), cl::cat(category));
+
+cl::opt<bool> runJit("run", cl::desc("Compile in memory and run the program instead of writing an object file"),
+                     cl::init(false), cl::cat(category));
+cl::opt<std::string> runEntry("entry", cl::desc("Function to call with --run (default main)"),
+                              cl::value_desc("function"), cl::init("main"), cl::cat(category));
+cl::list<int> runArgs("run-args", cl::CommaSeparated, cl::desc("Integer arguments to pass to the --run entry point"),
+                      cl::value_desc("n1,n2,..."), cl::cat(category));
+
+cl::opt<std::string> cacheDir("cache-dir",
+                              cl::desc("Reuse object files from this directory when neither the source nor the "
+                                       "options changed (default $KOPI_CACHE_DIR)"),
+                              cl::value_desc("directory"), cl::init(""), cl::cat(category));
+cl::opt<bool> incremental("fincremental",
+                          cl::desc("Cache the object of every function, so that only the functions that changed "
+                                   "are compiled again (needs --cache-dir)"),
+                          cl::init(false), cl::cat(category));
+
+cl::opt<bool> timeReport("ftime-report", cl::desc("Print the time spent in each compilation phase to stderr"),
+                         cl::init(false), cl::cat(category));
+cl::opt<std::string> timeTrace("ftime-trace", cl::desc("Write a Chrome trace of the compilation to this file"),
+                               cl::value_desc("filename"), cl::init(""), cl::cat(category));
+cl::opt<unsigned> timeTraceGranularity("ftime-trace-granularity",
+                                       cl::desc("Minimum duration of events in the trace, in microseconds "
+                                                "(default 500)"),
+                                       cl::value_desc("us"), cl::init(500), cl::cat(category));
+
+cl::opt<bool> syntaxOnly("fsyntax-only", cl::desc("Only check the input for errors, don't generate any code"),
+                         cl::init(false), cl::cat(category));
+cl::opt<bool> dumpAst("dump-ast", cl::desc("Print AST to stdout, without generating code unless --dump-ir is given"),
+                      cl::init(false), cl::cat(category));
+cl::opt<bool> dumpIr("dump-ir", cl::desc("Print LLVM IR to stdout"), cl::init(false), cl::cat(category));
 
-    std::filesystem::path sourcePath(inputName.c_str());
-    std::filesystem::path outputPath;
+cl::opt<std::string> serverSocket("server",
+                                  cl::desc("Keep running and compile the requests of kopic --client sent to this "
+                                           "Unix socket"),
+                                  cl::value_desc("socket"), cl::init(""), cl::cat(category));
+cl::opt<std::string> clientSocket("client",
+                                  cl::desc("Compile through the kopic --server listening on this socket, must be "
+                                           "the first argument"),
+                                  cl::value_desc("socket"), cl::init(""), cl::cat(category));
 
-    if (outputName.empty()) {
-        outputPath = sourcePath.stem().concat(".o");
-    } else {
-        outputPath = outputName.c_str();
+// Compiles the inputs as the parsed options say. When outputs is given, the
+// object files are compiled to temporary files and returned there instead of
+// being written to their output paths.
+static int compile(std::vector<remote::OutputFile> *outputs) {
+    if (inputNames.empty()) {
+        std::cerr << "No input files" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!serverSocket.empty() || !clientSocket.empty()) {
+        std::cerr << (serverSocket.empty() ? "--client must be the first argument" : "--server takes no input files")
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (StringRef("0123sz").find(optLevel) == StringRef::npos) {
+        std::cerr << "Invalid optimization level -O" << optLevel << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (inputNames.size() > 1 && !outputName.empty()) {
+        std::cerr << "-o can not be used with multiple input files" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (runJit && !targetTriple.empty()) {
+        std::cerr << "--run can not be used with -mtriple" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (inputNames.size() > 1 && runJit) {
+        std::cerr << "--run can not be used with multiple input files" << std::endl;
+        return EXIT_FAILURE;
     }
 
-    if (!codegenInit(inputName)) {
+    if (!lto.empty() && lto != "thin") {
+        std::cerr << "Unsupported LTO mode -flto=" << lto << ", only -flto=thin is supported" << std::endl;
+        return EXIT_FAILURE;
+    }
+    // Without --emit, ThinLTO objects are bitcode like clang's
+    bool emitGiven = emitKind.getNumOccurrences() > 0;
+    if (!lto.empty() && emitGiven && emitKind != EmitKind::Bitcode && emitKind != EmitKind::IR) {
+        std::cerr << "-flto=thin can only be used with --emit=bc or --emit=ll" << std::endl;
         return EXIT_FAILURE;
     }
 
-    std::ifstream infile(sourcePath);
-    if (!infile.is_open()) {
-        std::cerr << "Unable to open " << argv[1] << std::endl;
+    bool instrument = profileGenerate.getNumOccurrences() > 0;
+    if (instrument && !profileUse.empty()) {
+        std::cerr << "-fprofile-generate and -fprofile-use can not be used together" << std::endl;
+        return EXIT_FAILURE;
+    }
+    // The runtime that writes the profile isn't part of kopic
+    if (instrument && runJit) {
+        std::cerr << "-fprofile-generate can not be used with --run" << std::endl;
         return EXIT_FAILURE;
     }
+    if (!profileUse.empty() && !sys::fs::exists(profileUse)) {
+        std::cerr << "Profile " << profileUse << " does not exist" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    DriverOptions options;
+    options.codegen.optLevel = optLevel;
+    options.codegen.triple = targetTriple;
+    options.codegen.cpu = targetArch.empty() ? targetCpu : targetArch;
+    options.codegen.features = join(targetFeatures, ",");
+    options.codegen.pic = pic;
+    options.codegen.parallelCodegen = std::max(1u, parallelCodegen.getValue());
+    options.codegen.thinLTO = !lto.empty();
+    options.codegen.emit = options.codegen.thinLTO && !emitGiven ? EmitKind::Bitcode : emitKind.getValue();
+    options.codegen.profileGenerate = instrument;
+    options.codegen.profileGenerateFile = profileGenerate;
+    options.codegen.profileUse = profileUse;
+    options.dumpAst = dumpAst;
+    options.syntaxOnly = syntaxOnly || (dumpAst && !dumpIr && !runJit);
+    options.dumpIr = dumpIr;
+    // Checked through the option, since once enabled, LLVM's statistics stay
+    // enabled for the rest of the server's life
+    options.printStats = cl::getRegisteredOptions()["stats"]->getNumOccurrences() > 0;
+    options.timeReport = timeReport;
+    options.run = runJit;
+    options.runEntry = runEntry;
+    options.runArgs.assign(runArgs.begin(), runArgs.end());
 
-    TokenReader tokenizer(infile);
-    auto ast = parse(tokenizer);
-    if (ast == nullptr) {
-        infile.close();
+    std::string cacheDirectory = cacheDir;
+    if (const char *envCacheDir = getenv("KOPI_CACHE_DIR"); cacheDirectory.empty() && envCacheDir != nullptr) {
+        cacheDirectory = envCacheDir;
+    }
+    std::unique_ptr<ObjectCache> cache;
+    if (!cacheDirectory.empty()) {
+        cache = std::make_unique<ObjectCache>(cacheDirectory);
+    }
+    options.cache = cache.get();
+    options.incremental = incremental;
+    if (incremental && cache == nullptr) {
+        std::cerr << "-fincremental needs a cache directory, from --cache-dir or $KOPI_CACHE_DIR" << std::endl;
         return EXIT_FAILURE;
-    } else {
-        if (dumpAst) {
-            ast->dbgprint();
+    }
+    if (incremental && options.codegen.parallelCodegen > 1) {
+        std::cerr << "-fincremental can not be used with -fparallel-codegen" << std::endl;
+        return EXIT_FAILURE;
+    }
+    // The counters of the instrumentation are globals, which don't make it
+    // into the objects of single functions
+    if (incremental && instrument) {
+        std::cerr << "-fincremental can not be used with -fprofile-generate" << std::endl;
+        return EXIT_FAILURE;
+    }
+    // The module is only optimized once it's split into partitions, there's
+    // no optimized module as a whole to run or print
+    if (options.codegen.parallelCodegen > 1 && (runJit || dumpIr)) {
+        std::cerr << "-fparallel-codegen can not be used with " << (runJit ? "--run" : "--dump-ir") << std::endl;
+        return EXIT_FAILURE;
+    }
+    // Both combine the objects of their parts with the system linker
+    if ((incremental || options.codegen.parallelCodegen > 1) && options.codegen.emit != EmitKind::Object) {
+        std::cerr << (incremental ? "-fincremental" : "-fparallel-codegen") << " can only be used for object files"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // ThinLTO bitcode goes to .o files like clang's, unless --emit=bc asks
+    // for bitcode explicitly
+    EmitKind outputKind = emitGiven ? options.codegen.emit : EmitKind::Object;
+    std::vector<CompileJob> compileJobs(inputNames.size());
+    for (size_t i = 0; i < inputNames.size(); i++) {
+        compileJobs[i].input = inputNames[i];
+        compileJobs[i].output = outputName.empty() ? defaultOutputName(inputNames[i], outputKind) : outputName;
+    }
+
+    // The server compiles to temporary files and sends their contents to the
+    // client, which writes them to the actual outputs
+    std::vector<remote::OutputFile> redirected;
+    if (outputs != nullptr && !options.run && !options.syntaxOnly) {
+        for (CompileJob &job : compileJobs) {
+            SmallString<128> path;
+            if (std::error_code error = sys::fs::createTemporaryFile("kopic-server", "o", path)) {
+                std::cerr << "Unable to create temporary file: " << error.message() << std::endl;
+                for (size_t i = 0; i < redirected.size(); i++) {
+                    sys::fs::remove(compileJobs[i].output);
+                }
+                return EXIT_FAILURE;
+            }
+            redirected.push_back({job.output, ""});
+            job.output = std::string(path);
         }
-        ast->emit();
+    }
+
+    if (!timeTrace.empty()) {
+        timeTraceInitialize(timeTraceGranularity);
+    }
+
+    unsigned threads = jobs == 0 ? llvm::hardware_concurrency().compute_thread_count() : jobs;
+    bool succeeded = compileAll(compileJobs, options, threads);
 
-        if (dumpIr) {
-            codegenPrintIR();
+    for (size_t i = 0; i < redirected.size(); i++) {
+        if (compileJobs[i].succeeded) {
+            ErrorOr<std::unique_ptr<MemoryBuffer>> object = MemoryBuffer::getFile(compileJobs[i].output);
+            if (object) {
+                redirected[i].data = (*object)->getBuffer().str();
+                outputs->push_back(std::move(redirected[i]));
+            } else {
+                std::cerr << "Unable to read " << compileJobs[i].output << ": " << object.getError().message()
+                          << std::endl;
+                succeeded = false;
+            }
         }
-        codegenOutput(outputPath);
+        sys::fs::remove(compileJobs[i].output);
+    }
+
+    if (!timeTrace.empty() && !timeTraceWrite(timeTrace, std::cerr)) {
+        succeeded = false;
+    }
+    if (options.printStats) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        std::cerr << "=== kopic process ===\n";
+        std::cerr << "memory.peak_rss_kb " << usage.ru_maxrss << '\n';
+    }
+
+    if (cache != nullptr && options.printStats) {
+        std::cerr << "=== kopic cache: " << cacheDirectory << " ===\n";
+        std::cerr << "cache.hits " << cache->hits() << '\n';
+        std::cerr << "cache.misses " << cache->misses() << '\n';
+    }
+    if (!succeeded) {
+        return EXIT_FAILURE;
+    }
+
+    if (runJit) {
+        // The return value of main becomes the exit status, like it would for
+        // a linked program
+        if (runEntry == "main") {
+            return compileJobs[0].runResult;
+        }
+        std::cout << compileJobs[0].runResult << std::endl;
     }
 
     return EXIT_SUCCESS;
 }
+
+// Options that would make the server print something and exit
+static bool exitsServer(StringRef arg) {
+    arg = arg.ltrim('-').split('=').first;
+    return arg == "help" || arg == "help-list" || arg == "help-hidden" || arg == "help-list-hidden" ||
+           arg == "version" || arg == "print-options" || arg == "print-all-options";
+}
+
+static int handleRequest(const std::vector<std::string> &args, std::vector<remote::OutputFile> &outputs) {
+    std::vector<const char *> argv = {"kopic"};
+    for (const std::string &arg : args) {
+        if (exitsServer(arg)) {
+            std::cerr << arg << " can not be used with --client" << std::endl;
+            return EXIT_FAILURE;
+        }
+        argv.push_back(arg.c_str());
+    }
+
+    // Every request starts from the defaults, not from the options the server
+    // was started with
+    cl::ResetAllOptionOccurrences();
+    std::string errors;
+    raw_string_ostream errorStream(errors);
+    if (!cl::ParseCommandLineOptions(argv.size(), argv.data(), "", &errorStream)) {
+        std::cerr << errorStream.str();
+        return EXIT_FAILURE;
+    }
+    return compile(&outputs);
+}
+
+int main(int argc, char *argv[]) {
+    // Checked before anything else, so the client starts as quickly as possible
+    if (argc > 1 && StringRef(argv[1]).starts_with("--client=")) {
+        return remote::clientMain(argc, argv);
+    }
+
+    cl::HideUnrelatedOptions(category);
+
+    // LLVM already registers -stats, reuse it to enable our own statistics
+    cl::Option *statsOption = cl::getRegisteredOptions()["stats"];
+    statsOption->setDescription("Print compiler statistics to stderr");
+    statsOption->setHiddenFlag(cl::NotHidden);
+    statsOption->addCategory(category);
+
+    cl::AddExtraVersionPrinter([](raw_ostream &os) { os << "kopic version " << kopicVersion << '\n'; });
+    cl::ParseCommandLineOptions(argc, argv);
+
+    if (!serverSocket.empty() && inputNames.empty()) {
+        // Set up the host's backend now instead of during the first request
+        codegenRegisterTarget(CodegenOptions());
+        codegenReuseTargetMachines();
+        // Workers start out with a machine for the host at every -O level
+        for (char level : StringRef("0123sz")) {
+            CodegenOptions options;
+            options.optLevel = level;
+            codegenPrepareTargetMachine(options);
+        }
+        return remote::runServer(serverSocket, handleRequest);
+    }
+    return compile(nullptr);
+}
@@ -1,216 +1,465 @@
 #include "parser.hpp"
 
-#include <iostream>
-#include <memory>
-#include <stack>
-#include <utility>
+#include <llvm/ADT/STLExtras.h>
+
 #include <vector>
 
+// Binding power of binary operators, 0 for tokens that aren't one
 static int precedence(TokenType type) {
     switch (type) {
+    case TokenType::Equal:
+    case TokenType::NotEqual:
+        return 1;
+    case TokenType::Less:
+    case TokenType::LessEqual:
+    case TokenType::Greater:
+    case TokenType::GreaterEqual:
+        return 2;
     case TokenType::Plus:
     case TokenType::Minus:
-        return 1;
+        return 3;
     case TokenType::Multiply:
     case TokenType::Divide:
-        return 2;
+        return 4;
     default:
         return 0;
     }
 }
 
-static std::unique_ptr<ExprASTNode> parseExpr(TokenReader &tokenizer) {
-    // https://en.wikipedia.org/wiki/Shunting_yard_algorithm
-    std::stack<ExprASTNode *> exprStack;
-    std::stack<Token> unaryOpStack;
-    std::stack<Token> binaryOpStack;
-    bool expectingOperand = true;
-    int bracketDepth = 0;
-
-    auto placeUnaryOp = [&exprStack, &unaryOpStack]() {
-        Token unaryOpToken = unaryOpStack.top();
-        unaryOpStack.pop();
-        std::unique_ptr<ExprASTNode> operand(exprStack.top());
-        exprStack.pop();
-        exprStack.emplace(new UnaryOpExprASTNode(unaryOpToken, std::move(operand)));
-    };
-
-    auto placeBinaryOp = [&exprStack, &binaryOpStack]() {
-        assert(!binaryOpStack.empty());
-
-        Token operatorToken = binaryOpStack.top();
-        binaryOpStack.pop();
-
-        std::unique_ptr<ExprASTNode> operandExpr2(exprStack.top());
-        exprStack.pop();
-        std::unique_ptr<ExprASTNode> operandExpr1(exprStack.top());
-        exprStack.pop();
-        exprStack.emplace(new BinaryOpExprASTNode(operatorToken, std::move(operandExpr1), std::move(operandExpr2)));
-    };
-
-    while (tokenizer.peek() != TokenType::Semicolon && tokenizer.peek() != TokenType::Comma
-           && !(bracketDepth == 0 && tokenizer.peek() == TokenType::CloseBracket)) {
-        Token token = tokenizer.next();
-        switch (token.type) {
-        case TokenType::Number:
-            exprStack.emplace(new NumericExprASTNode(token));
-            if (!unaryOpStack.empty() && unaryOpStack.top().type != TokenType::OpenBracket) {
-                placeUnaryOp();
-            }
-            expectingOperand = false;
-            break;
-        case TokenType::Identifier:
-            if (tokenizer.peek() == TokenType::OpenBracket) {
-                std::vector<std::unique_ptr<ExprASTNode>> args;
-                tokenizer.next();
-                do {
-                    if (tokenizer.peek() == TokenType::CloseBracket) {
-                        break;
-                    }
-                    auto expr = parseExpr(tokenizer);
-                    args.emplace_back(std::move(expr));
-
-                    if (tokenizer.peek() == TokenType::CloseBracket) {
-                        break;
-                    }
-                    if (!tokenizer.expectNext(TokenType::Comma))
-                        return nullptr;
-                } while (1);
-                if (!tokenizer.expectNext(TokenType::CloseBracket))
-                    return nullptr;
-                exprStack.emplace(new FuncCallExprASTNode(token, std::move(args)));
-            } else {
-                exprStack.emplace(new IdentifierExprASTNode(token));
-            }
-            if (!unaryOpStack.empty() && unaryOpStack.top().type != TokenType::OpenBracket) {
-                placeUnaryOp();
-            }
-            expectingOperand = false;
-            break;
-        case TokenType::Plus:
-        case TokenType::Minus:
-        case TokenType::Multiply:
-        case TokenType::Divide:
-            if (expectingOperand) {
-                unaryOpStack.push(token);
-            } else {
-                Token otherToken;
-                while ((!binaryOpStack.empty() && (otherToken = binaryOpStack.top()).type != TokenType::OpenBracket)
-                       && precedence(otherToken.type) >= precedence(token.type)) {
-                    placeBinaryOp();
-                }
-                binaryOpStack.emplace(token);
-                expectingOperand = true;
-            }
-            break;
-        case TokenType::OpenBracket:
-            if (!unaryOpStack.empty()) {
-                unaryOpStack.emplace(token);
-            }
-            binaryOpStack.emplace(token);
-            bracketDepth++;
-            break;
-        case TokenType::CloseBracket:
-            while (binaryOpStack.top().type != TokenType::OpenBracket) {
-                placeBinaryOp();
-            }
-            assert(binaryOpStack.top().type == TokenType::OpenBracket);
-            binaryOpStack.pop();
-
-            if (!unaryOpStack.empty() && unaryOpStack.top().type == TokenType::OpenBracket) {
-                assert(!exprStack.empty());
-                unaryOpStack.pop();
-                placeUnaryOp();
-            }
-
-            bracketDepth--;
+// Literals are at most INT32_MAX. Only a literal negated by a unary minus
+// may be 2^31, which wraps to INT32_MIN so that -2147483648 comes out right
+// once the minus is applied.
+static bool parseNumber(TokenReader &tokenizer, Token token, int32_t *value, bool negated = false) {
+    uint64_t limit = negated ? uint64_t(1) << 31 : INT32_MAX;
+    uint64_t result = 0;
+    for (char c : tokenizer.source().text(token)) {
+        result = result * 10 + (c - '0');
+        if (result > limit) {
+            tokenizer.source().error(token.offset) << "Integer literal " << tokenizer.source().text(token)
+                                                   << " is out of range" << std::endl;
+            return false;
+        }
+    }
+    *value = static_cast<int32_t>(static_cast<uint32_t>(result));
+    return true;
+}
+
+namespace {
+
+// Recursive descent parser, with precedence climbing for expressions. Lists
+// of call arguments and statements are collected on scratch stacks that are
+// reused for the whole file, and copied into the arena once complete, so
+// parsing only allocates the nodes themselves.
+class Parser {
+  public:
+    Parser(TokenReader &tokenizer, ASTArena &arena) : tokenizer(tokenizer), arena(arena) {
+    }
+
+    SourceFileASTNode *parseFile();
+
+  private:
+    // Brackets, calls, unary operators and statement bodies nest, this many
+    // levels deep at most. Later stages walk the tree recursively too, so this
+    // also keeps them from running out of stack. Chains of binary operators
+    // don't count, since every stage walks those in a loop.
+    static constexpr unsigned maxNesting = 1024;
+
+    ExprASTNode *parseExpr(int minPrecedence = 1);
+    ExprASTNode *parseUnary();
+    ExprASTNode *parsePrimary(bool negated = false);
+    ExprASTNode *parseCall(Token function);
+    StmtASTNode *parseStmt();
+    StmtASTNode *parseVariableDecl();
+    StmtASTNode *parseAssignment(Token ident);
+    StmtASTNode *parseIf(Token keyword);
+    StmtASTNode *parseLoop(Token start);
+    StmtASTNode *parseBody(Token start);
+    CompoundStmtASTNode *parseCompoundStmt();
+    const AnnotationName *parseAnnotation(llvm::ArrayRef<AnnotationName> names, const char *kind,
+                                          uint32_t *annotations, uint32_t *count);
+    FuncASTNode *parseFunction();
+
+    [[nodiscard]] bool enter(const Token &token);
+    void leave() {
+        nesting--;
+    }
+
+    std::ostream &error(uint32_t offset) {
+        return tokenizer.source().error(offset);
+    }
+
+    TokenReader &tokenizer;
+    ASTArena &arena;
+    unsigned nesting = 0;
+
+    std::vector<ExprASTNode *> argStack;
+    std::vector<StmtASTNode *> stmtStack;
+    std::vector<Token> params;
+};
+
+} // namespace
+
+bool Parser::enter(const Token &token) {
+    if (++nesting > maxNesting) {
+        error(token.offset) << "Expression is nested more than " << maxNesting << " levels deep" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Parses a chain of operands and the binary operators between them, as long
+// as the operators bind at least as tightly as minPrecedence. Operators of the
+// same precedence group to the left.
+ExprASTNode *Parser::parseExpr(int minPrecedence) {
+    ExprASTNode *left = parseUnary();
+    while (left != nullptr) {
+        int opPrecedence = precedence(tokenizer.peek());
+        if (opPrecedence == 0 || opPrecedence < minPrecedence)
             break;
-        default:
-            std::cerr << "Unexcpected token" << std::endl;
+        Token op = tokenizer.next();
+        ExprASTNode *right = parseExpr(opPrecedence + 1);
+        if (right == nullptr)
             return nullptr;
-        }
+        left = arena.make<BinaryOpExprASTNode>(op, left, right);
     }
+    return left;
+}
+
+// Unary operators apply to the operand right after them, before any binary
+// operator, so -a * b is (-a) * b
+ExprASTNode *Parser::parseUnary() {
+    TokenType type = tokenizer.peek();
+    if (type != TokenType::Plus && type != TokenType::Minus)
+        return parsePrimary();
 
-    while (!binaryOpStack.empty()) {
-        assert(binaryOpStack.top().type != TokenType::OpenBracket);
-        placeBinaryOp();
+    Token op = tokenizer.next();
+    if (!enter(op))
+        return nullptr;
+    // A literal right after a minus may be 2^31, nowhere else
+    bool negatedLiteral = op.type == TokenType::Minus && tokenizer.peek() == TokenType::Number;
+    ExprASTNode *operand = negatedLiteral ? parsePrimary(true) : parseUnary();
+    leave();
+    return operand != nullptr ? arena.make<UnaryOpExprASTNode>(op, operand) : nullptr;
+}
+
+ExprASTNode *Parser::parsePrimary(bool negated) {
+    Token token = tokenizer.next();
+    switch (token.type) {
+    case TokenType::Number: {
+        int32_t value;
+        if (!parseNumber(tokenizer, token, &value, negated))
+            return nullptr;
+        return arena.make<NumericExprASTNode>(token, value);
     }
+    case TokenType::Identifier:
+        if (tokenizer.peek() == TokenType::OpenBracket)
+            return parseCall(token);
+        return arena.make<IdentifierExprASTNode>(token);
+    case TokenType::OpenBracket: {
+        if (!enter(token))
+            return nullptr;
+        ExprASTNode *expr = parseExpr();
+        leave();
+        if (expr == nullptr || !tokenizer.expectNext(TokenType::CloseBracket))
+            return nullptr;
+        return expr;
+    }
+    default:
+        error(token.offset) << "Expected an expression, got '" << tokenTypeName(token.type) << '\'' << std::endl;
+        return nullptr;
+    }
+}
 
-    std::unique_ptr<ExprASTNode> result(exprStack.top());
-    return result;
+ExprASTNode *Parser::parseCall(Token function) {
+    Token open = tokenizer.next();
+    if (!enter(open))
+        return nullptr;
+
+    // Arguments of calls in the arguments are pushed above these ones, and
+    // popped again before the next argument of this call
+    size_t base = argStack.size();
+    bool succeeded = true;
+    if (tokenizer.peek() != TokenType::CloseBracket) {
+        for (;;) {
+            ExprASTNode *arg = parseExpr();
+            succeeded = arg != nullptr;
+            if (!succeeded)
+                break;
+            argStack.push_back(arg);
+            if (tokenizer.peek() != TokenType::Comma)
+                break;
+            tokenizer.next();
+        }
+    }
+    succeeded = succeeded && tokenizer.expectNext(TokenType::CloseBracket);
+    leave();
+
+    ExprASTNode *call = nullptr;
+    if (succeeded) {
+        auto args = arena.copy<ExprASTNode *>(llvm::ArrayRef<ExprASTNode *>(argStack).drop_front(base));
+        call = arena.make<FuncCallExprASTNode>(function, args);
+    }
+    argStack.resize(base);
+    return call;
 }
 
 // Parse any kind of statement
-static std::unique_ptr<StmtASTNode> parseStmt(TokenReader &tokenizer) {
+StmtASTNode *Parser::parseStmt() {
+    if (tokenizer.peek() == TokenType::OpenBrace)
+        return parseCompoundStmt();
+    if (tokenizer.peek() == TokenType::Int) {
+        StmtASTNode *decl = parseVariableDecl();
+        return decl != nullptr && tokenizer.expectNext(TokenType::Semicolon) ? decl : nullptr;
+    }
+
     Token token = tokenizer.next();
     if (token.type == TokenType::Return) {
-        auto expr = parseExpr(tokenizer);
+        ExprASTNode *expr = parseExpr();
         if (expr == nullptr)
             return nullptr;
         if (!tokenizer.expectNext(TokenType::Semicolon))
             return nullptr;
-        return std::make_unique<ReturnStmtASTNode>(expr);
-    } else if (token.type == TokenType::Int) {
-        Token ident;
-        if (!tokenizer.expectNext(TokenType::Identifier, &ident)) {
+        return arena.make<ReturnStmtASTNode>(expr);
+    } else if (token.type == TokenType::Identifier) {
+        StmtASTNode *assignment = parseAssignment(token);
+        return assignment != nullptr && tokenizer.expectNext(TokenType::Semicolon) ? assignment : nullptr;
+    } else if (token.type == TokenType::If) {
+        return parseIf(token);
+    } else if (token.type == TokenType::While || token.type == TokenType::For || token.type == TokenType::At) {
+        return parseLoop(token);
+    } else {
+        error(token.offset) << "Unrecognized statement type" << std::endl;
+        return nullptr;
+    }
+}
+
+// A declaration without the semicolon, which a for loop's initialization
+// doesn't have either
+StmtASTNode *Parser::parseVariableDecl() {
+    Token ident;
+    if (!tokenizer.expectNext(TokenType::Int) || !tokenizer.expectNext(TokenType::Identifier, &ident))
+        return nullptr;
+
+    ExprASTNode *initExpr = nullptr;
+    if (tokenizer.peek() == TokenType::Assign) {
+        tokenizer.next();
+        initExpr = parseExpr();
+        if (initExpr == nullptr)
             return nullptr;
-        }
+    }
+    return arena.make<VariableDeclStmtASTNode>(ident, initExpr);
+}
 
-        std::unique_ptr<ExprASTNode> initExpr;
-        if (tokenizer.peek() == TokenType::Assign) {
-            tokenizer.next();
-            initExpr = parseExpr(tokenizer);
-            if (initExpr == nullptr)
-                return nullptr;
-        }
+// An assignment without the semicolon, after the identifier
+StmtASTNode *Parser::parseAssignment(Token ident) {
+    if (!tokenizer.expectNext(TokenType::Assign))
+        return nullptr;
 
-        if (!tokenizer.expectNext(TokenType::Semicolon))
+    ExprASTNode *expr = parseExpr();
+    if (expr == nullptr)
+        return nullptr;
+    return arena.make<AssignmentStmtASTNode>(ident, expr);
+}
+
+StmtASTNode *Parser::parseIf(Token keyword) {
+    if (!tokenizer.expectNext(TokenType::OpenBracket))
+        return nullptr;
+    ExprASTNode *cond = parseExpr();
+    if (cond == nullptr || !tokenizer.expectNext(TokenType::CloseBracket))
+        return nullptr;
+
+    StmtASTNode *then = parseBody(keyword);
+    if (then == nullptr)
+        return nullptr;
+
+    // An else belongs to the closest if that doesn't have one yet
+    StmtASTNode *otherwise = nullptr;
+    if (tokenizer.peek() == TokenType::Else) {
+        otherwise = parseBody(tokenizer.next());
+        if (otherwise == nullptr)
             return nullptr;
-        return std::make_unique<VariableDeclStmtASTNode>(ident, std::move(initExpr));
-    } else if (token.type == TokenType::Identifier) {
-        std::unique_ptr<ExprASTNode> expr;
+    }
+    return arena.make<IfStmtASTNode>(cond, then, otherwise);
+}
 
-        if (!tokenizer.expectNext(TokenType::Assign))
+// Parses a while or for loop, with the annotations in front of it. The first
+// token has already been read.
+StmtASTNode *Parser::parseLoop(Token start) {
+    LoopHints hints;
+    while (start.type == TokenType::At) {
+        uint32_t count;
+        const AnnotationName *annotation = parseAnnotation(loopAnnotationNames(), "loop", &hints.annotations, &count);
+        if (annotation == nullptr)
             return nullptr;
+        if (annotation->annotation == AnnotateUnroll) {
+            hints.unrollCount = count;
+        } else if (annotation->annotation == AnnotateVectorize) {
+            hints.vectorizeWidth = count;
+        }
+        start = tokenizer.next();
+    }
+    if (start.type != TokenType::While && start.type != TokenType::For) {
+        error(start.offset) << "Expected a loop, got '" << tokenTypeName(start.type) << '\'' << std::endl;
+        return nullptr;
+    }
+    if (!tokenizer.expectNext(TokenType::OpenBracket))
+        return nullptr;
 
-        expr = parseExpr(tokenizer);
-        if (expr == nullptr)
+    StmtASTNode *init = nullptr;
+    ExprASTNode *cond = nullptr;
+    StmtASTNode *step = nullptr;
+    if (start.type == TokenType::While) {
+        cond = parseExpr();
+        if (cond == nullptr)
+            return nullptr;
+    } else {
+        // The initialization declares or assigns a variable, and the step
+        // assigns one
+        TokenType initType = tokenizer.peek();
+        if (initType == TokenType::Int || initType == TokenType::Identifier) {
+            init = initType == TokenType::Int ? parseVariableDecl() : parseAssignment(tokenizer.next());
+            if (init == nullptr)
+                return nullptr;
+        }
+        if (!tokenizer.expectNext(TokenType::Semicolon))
             return nullptr;
 
+        if (tokenizer.peek() != TokenType::Semicolon) {
+            cond = parseExpr();
+            if (cond == nullptr)
+                return nullptr;
+        }
         if (!tokenizer.expectNext(TokenType::Semicolon))
             return nullptr;
 
-        return std::make_unique<AssignmentStmtASTNode>(token, std::move(expr));
-    } else {
-        std::cerr << "Unrecognized statement type" << std::endl;
-        return nullptr;
+        if (tokenizer.peek() != TokenType::CloseBracket) {
+            Token ident;
+            if (!tokenizer.expectNext(TokenType::Identifier, &ident))
+                return nullptr;
+            step = parseAssignment(ident);
+            if (step == nullptr)
+                return nullptr;
+        }
     }
+    if (!tokenizer.expectNext(TokenType::CloseBracket))
+        return nullptr;
+
+    StmtASTNode *body = parseBody(start);
+    if (body == nullptr)
+        return nullptr;
+    return arena.make<LoopStmtASTNode>(hints, init, cond, step, body);
+}
+
+// The statement that an if, else or loop runs, which may be another one of
+// those, so this counts as nesting
+StmtASTNode *Parser::parseBody(Token start) {
+    if (!enter(start))
+        return nullptr;
+    StmtASTNode *body = parseStmt();
+    leave();
+    return body;
 }
 
 // Specifically parse a compound statement. Function bodies cannot be any other
-// kind of statement.
-static std::unique_ptr<CompoundStmtASTNode> parseCompoundStmt(TokenReader &tokenizer) {
-    if (!tokenizer.expectNext(TokenType::OpenBrace))
+// kind of statement, but blocks can also be nested inside of other blocks.
+CompoundStmtASTNode *Parser::parseCompoundStmt() {
+    Token open;
+    if (!tokenizer.expectNext(TokenType::OpenBrace, &open) || !enter(open))
         return nullptr;
 
-    std::vector<std::unique_ptr<StmtASTNode>> stmts;
-    while (tokenizer.peek() != TokenType::CloseBrace) {
-        auto stmt = parseStmt(tokenizer);
-        if (stmt == nullptr)
-            return nullptr;
-        stmts.emplace_back(std::move(stmt));
+    // Statements of nested blocks go above these ones, like call arguments
+    size_t base = stmtStack.size();
+    bool succeeded = true;
+    while (succeeded && tokenizer.peek() != TokenType::CloseBrace && tokenizer.peek() != TokenType::EoF) {
+        StmtASTNode *stmt = parseStmt();
+        succeeded = stmt != nullptr;
+        if (succeeded)
+            stmtStack.push_back(stmt);
     }
+    succeeded = succeeded && tokenizer.expectNext(TokenType::CloseBrace);
+    leave();
 
-    if (!tokenizer.expectNext(TokenType::CloseBrace))
-        return nullptr;
+    CompoundStmtASTNode *block = nullptr;
+    if (succeeded) {
+        auto stmts = arena.copy<StmtASTNode *>(llvm::ArrayRef<StmtASTNode *>(stmtStack).drop_front(base));
+        block = arena.make<CompoundStmtASTNode>(stmts);
+    }
+    stmtStack.resize(base);
+    return block;
+}
 
-    return std::make_unique<CompoundStmtASTNode>(std::move(stmts));
+// Parses the name of an annotation after its @, and the count in brackets
+// that may follow it, which is 0 otherwise. Adds the annotation to the set of
+// the ones that came before it on the same function or loop.
+const AnnotationName *Parser::parseAnnotation(llvm::ArrayRef<AnnotationName> names, const char *kind,
+                                              uint32_t *annotations, uint32_t *count) {
+    Token name;
+    if (!tokenizer.expectNext(TokenType::Identifier, &name))
+        return nullptr;
+    std::string_view text = tokenizer.source().text(name);
+    auto known = llvm::find_if(names, [&](const AnnotationName &annotation) { return annotation.name == text; });
+    if (known == names.end()) {
+        error(name.offset) << "Unknown " << kind << " annotation @" << text << std::endl;
+        return nullptr;
+    }
+    if (*annotations & known->annotation) {
+        error(name.offset) << "Duplicate annotation @" << text << std::endl;
+        return nullptr;
+    }
+    for (const AnnotationName &other : names) {
+        if (*annotations & known->conflicts & other.annotation) {
+            error(name.offset) << "@" << text << " can't be combined with @" << other.name << std::endl;
+            return nullptr;
+        }
+    }
+    *annotations |= known->annotation;
+
+    *count = 0;
+    if (known->takesCount && tokenizer.peek() == TokenType::OpenBracket) {
+        tokenizer.next();
+        Token number;
+        int32_t value;
+        if (!tokenizer.expectNext(TokenType::Number, &number) || !parseNumber(tokenizer, number, &value))
+            return nullptr;
+        if (value <= 0) {
+            error(number.offset) << "The count of @" << text << " must be positive" << std::endl;
+            return nullptr;
+        }
+        if (!tokenizer.expectNext(TokenType::CloseBracket))
+            return nullptr;
+        *count = value;
+    }
+    return &*known;
 }
 
-static std::unique_ptr<FuncASTNode> parseFunction(TokenReader &tokenizer) {
-    // Parse function
-    if (!tokenizer.expectNext(TokenType::Public))
+FuncASTNode *Parser::parseFunction() {
+    // Annotations come first, the definition starts at the first of them
+    Token start = tokenizer.next();
+    uint32_t begin = start.offset;
+    uint32_t annotations = 0;
+    while (start.type == TokenType::At) {
+        uint32_t count;
+        if (parseAnnotation(funcAnnotationNames(), "function", &annotations, &count) == nullptr)
+            return nullptr;
+        start = tokenizer.next();
+    }
+
+    Visibility vis;
+    switch (start.type) {
+    case TokenType::Public:
+        vis = Visibility::Public;
+        break;
+    case TokenType::Protected:
+        vis = Visibility::Protected;
+        break;
+    case TokenType::Private:
+        vis = Visibility::Private;
+        break;
+    default:
+        error(start.offset) << "Expected 'public', 'protected' or 'private', got '" << tokenTypeName(start.type)
+                            << '\'' << std::endl;
         return nullptr;
+    }
     if (!tokenizer.expectNext(TokenType::Int))
         return nullptr;
 
@@ -221,7 +470,7 @@ static std::unique_ptr<FuncASTNode> parseFunction(TokenReader &tokenizer) {
     if (!tokenizer.expectNext(TokenType::OpenBracket))
         return nullptr;
 
-    std::vector<Token> params;
+    params.clear();
     while (tokenizer.peek() != TokenType::CloseBracket) {
         if (!tokenizer.expectNext(TokenType::Int))
             return nullptr;
@@ -239,19 +488,27 @@ static std::unique_ptr<FuncASTNode> parseFunction(TokenReader &tokenizer) {
 
     if (!tokenizer.expectNext(TokenType::CloseBracket))
         return nullptr;
+    auto paramTokens = arena.copy<Token>(params);
 
-    auto stmt = parseCompoundStmt(tokenizer);
+    CompoundStmtASTNode *stmt = parseCompoundStmt();
     if (stmt == nullptr)
         return nullptr;
 
-    auto func = std::make_unique<FuncASTNode>(ident, params, stmt);
-    return func;
+    return arena.make<FuncASTNode>(begin, annotations, vis, ident, paramTokens, stmt);
 }
 
-std::unique_ptr<ASTNode> parse(TokenReader &tokenizer) {
-    std::vector<std::unique_ptr<FuncASTNode>> functions;
+SourceFileASTNode *Parser::parseFile() {
+    std::vector<FuncASTNode *> functions;
     while (tokenizer.peek() != TokenType::EoF) {
-        functions.emplace_back(parseFunction(tokenizer));
+        FuncASTNode *func = parseFunction();
+        if (func == nullptr)
+            return nullptr;
+        functions.push_back(func);
     }
-    return std::make_unique<SourceFileASTNode>(std::move(functions));
+    return arena.make<SourceFileASTNode>(arena.copy<FuncASTNode *>(functions));
+}
+
+SourceFileASTNode *parse(TokenReader &tokenizer, ASTArena &arena) {
+    Parser parser(tokenizer, arena);
+    return parser.parseFile();
 }
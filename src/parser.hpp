@@ -1,8 +1,7 @@
 #pragma once
 
-#include <memory>
-
 #include "ast.hpp"
 #include "token.hpp"
 
-std::unique_ptr<ASTNode> parse(TokenReader &tokenizer);
+// All nodes of the returned tree are allocated in the given arena
+SourceFileASTNode *parse(TokenReader &tokenizer, ASTArena &arena);
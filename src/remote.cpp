@@ -0,0 +1,170 @@
+#include "remote.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace remote {
+
+static bool writeAll(int fd, const void *data, size_t size) {
+    const char *bytes = static_cast<const char *>(data);
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void *data, size_t size) {
+    char *bytes = static_cast<char *>(data);
+    while (size > 0) {
+        ssize_t count = read(fd, bytes, size);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        bytes += count;
+        size -= count;
+    }
+    return true;
+}
+
+static bool writeU32(int fd, uint32_t value) {
+    return writeAll(fd, &value, sizeof(value));
+}
+
+static bool readU32(int fd, uint32_t &value) {
+    return readAll(fd, &value, sizeof(value));
+}
+
+static bool writeString(int fd, std::string_view string) {
+    return writeU32(fd, string.size()) && writeAll(fd, string.data(), string.size());
+}
+
+static bool readString(int fd, std::string &string) {
+    uint32_t size;
+    if (!readU32(fd, size))
+        return false;
+    string.resize(size);
+    return readAll(fd, string.data(), size);
+}
+
+bool writeRequest(int fd, const Request &request) {
+    if (!writeU32(fd, protocolVersion) || !writeString(fd, request.workingDirectory) ||
+        !writeU32(fd, request.args.size()))
+        return false;
+    for (const std::string &arg : request.args) {
+        if (!writeString(fd, arg))
+            return false;
+    }
+    return writeString(fd, request.cacheDirectory);
+}
+
+bool readRequest(int fd, Request &request) {
+    uint32_t version, argCount;
+    if (!readU32(fd, version) || version != protocolVersion || !readString(fd, request.workingDirectory) ||
+        !readU32(fd, argCount))
+        return false;
+    request.args.resize(argCount);
+    for (std::string &arg : request.args) {
+        if (!readString(fd, arg))
+            return false;
+    }
+    return readString(fd, request.cacheDirectory);
+}
+
+bool writeResponse(int fd, const Response &response) {
+    if (!writeU32(fd, response.status) || !writeString(fd, response.out) || !writeString(fd, response.err) ||
+        !writeU32(fd, response.outputs.size()))
+        return false;
+    for (const OutputFile &output : response.outputs) {
+        if (!writeString(fd, output.path) || !writeString(fd, output.data))
+            return false;
+    }
+    return true;
+}
+
+bool readResponse(int fd, Response &response) {
+    uint32_t status, outputCount;
+    if (!readU32(fd, status) || !readString(fd, response.out) || !readString(fd, response.err) ||
+        !readU32(fd, outputCount))
+        return false;
+    response.status = status;
+    response.outputs.resize(outputCount);
+    for (OutputFile &output : response.outputs) {
+        if (!readString(fd, output.path) || !readString(fd, output.data))
+            return false;
+    }
+    return true;
+}
+
+int runClient(const std::string &socketPath, const std::vector<std::string> &args) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path is too long: " << socketPath << std::endl;
+        return EXIT_FAILURE;
+    }
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        std::cerr << "Unable to connect to kopic server at " << socketPath << ": " << strerror(errno) << std::endl;
+        if (fd >= 0)
+            close(fd);
+        return EXIT_FAILURE;
+    }
+
+    Request request;
+    char *cwd = getcwd(nullptr, 0);
+    if (cwd != nullptr) {
+        request.workingDirectory = cwd;
+        free(cwd);
+    }
+    request.args = args;
+    if (const char *cacheDirectory = getenv("KOPI_CACHE_DIR")) {
+        request.cacheDirectory = cacheDirectory;
+    }
+
+    Response response;
+    bool ok = writeRequest(fd, request) && readResponse(fd, response);
+    close(fd);
+    if (!ok) {
+        std::cerr << "Lost connection to kopic server at " << socketPath << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << response.out << std::flush;
+    std::cerr << response.err << std::flush;
+    for (const OutputFile &output : response.outputs) {
+        std::ofstream file(output.path, std::ios::binary | std::ios::trunc);
+        file.write(output.data.data(), output.data.size());
+        if (!file.flush()) {
+            std::cerr << "Unable to write " << output.path << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    return response.status;
+}
+
+int clientMain(int argc, char *argv[]) {
+    std::string_view prefix = "--client=";
+    if (argc < 2 || std::string_view(argv[1]).substr(0, prefix.size()) != prefix) {
+        std::cerr << "usage: " << argv[0] << " --client=<socket> [kopic options] <input files>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return runClient(argv[1] + prefix.size(), std::vector<std::string>(argv + 2, argv + argc));
+}
+
+} // namespace remote
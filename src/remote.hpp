@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Compiling through a long running kopic --server, so each compilation
+// doesn't pay for starting the process and setting up LLVM again.
+//
+// A client connects to the server's Unix socket and sends one request, made of
+// its working directory, arguments and $KOPI_CACHE_DIR. The server compiles as
+// if it had been started with those in that directory, and answers with the exit
+// status, everything printed to stdout and stderr, and the contents of the
+// object files, which the client writes itself.
+//
+// Every message is a sequence of fields, either a 32-bit integer in host byte
+// order or a string prefixed with its 32-bit length. Client and server always
+// run on the same machine.
+//
+// This header doesn't use LLVM, so the client can be built without it.
+
+namespace remote {
+
+// Bumped when the messages change, a server refuses requests with another
+// version
+inline constexpr uint32_t protocolVersion = 2;
+
+// An object file compiled for the client, path is relative to the client's
+// working directory
+struct OutputFile {
+    std::string path;
+    std::string data;
+};
+
+struct Request {
+    std::string workingDirectory;
+    // Command line arguments, without the program name
+    std::vector<std::string> args;
+    // The client's $KOPI_CACHE_DIR, empty if it isn't set
+    std::string cacheDirectory;
+};
+
+struct Response {
+    int32_t status = 0;
+    std::string out;
+    std::string err;
+    std::vector<OutputFile> outputs;
+};
+
+bool writeRequest(int fd, const Request &request);
+bool readRequest(int fd, Request &request);
+bool writeResponse(int fd, const Response &response);
+bool readResponse(int fd, Response &response);
+
+// Compiles one request with the server's command line options reset to the
+// request's arguments. Returns the exit status, and adds the object files
+// that were written to outputs instead of to disk.
+using RequestHandler = std::function<int(const std::vector<std::string> &args, std::vector<OutputFile> &outputs)>;
+
+// Accepts requests until the process is stopped, and handles each in a
+// process forked for it, so that they run at the same time
+int runServer(const std::string &socketPath, const RequestHandler &handler);
+
+// Sends args to the server and acts on the response, returns the exit status
+int runClient(const std::string &socketPath, const std::vector<std::string> &args);
+
+// Entry point for kopic --client=<socket> [kopic arguments...], shared by kopic
+// and the kopic-client binary, which starts faster since it doesn't load LLVM
+int clientMain(int argc, char *argv[]);
+
+} // namespace remote
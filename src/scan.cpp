@@ -0,0 +1,149 @@
+#include "scan.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define KOPIC_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static constexpr std::array<uint8_t, 256> makeCharClasses() {
+    std::array<uint8_t, 256> classes = {};
+    for (unsigned c = 0; c < 256; c++) {
+        if (c == ' ' || (c >= '\t' && c <= '\r'))
+            classes[c] = CharSpace;
+        else if (c >= '0' && c <= '9')
+            classes[c] = CharDigit;
+        else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+            classes[c] = CharLetter;
+    }
+    return classes;
+}
+
+const std::array<uint8_t, 256> charClasses = makeCharClasses();
+
+static const char *skipScalar(const char *cur, const char *end, uint8_t classes) {
+    while (cur != end && isCharClass(*cur, classes))
+        cur++;
+    return cur;
+}
+
+#ifdef KOPIC_SCAN_X86
+
+// Each class sets all bits of the bytes of a vector that are in it. Byte
+// ranges are checked with an unsigned minimum, SSE2 has no unsigned compare.
+struct Sse2 {
+    using Vector = __m128i;
+    static constexpr int width = 16;
+
+    static Vector load(const char *p) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    }
+    static uint32_t mask(Vector v) {
+        return _mm_movemask_epi8(v);
+    }
+    static Vector inRange(Vector v, char low, char count) {
+        Vector offset = _mm_sub_epi8(v, _mm_set1_epi8(low));
+        return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(count - 1)), offset);
+    }
+    static Vector space(Vector v) {
+        return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), inRange(v, '\t', 5));
+    }
+    static Vector digit(Vector v) {
+        return inRange(v, '0', 10);
+    }
+    static Vector alnum(Vector v) {
+        return _mm_or_si128(digit(v), inRange(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 26));
+    }
+};
+
+struct Avx2 {
+    using Vector = __m256i;
+    static constexpr int width = 32;
+
+    __attribute__((target("avx2"))) static Vector load(const char *p) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    }
+    __attribute__((target("avx2"))) static uint32_t mask(Vector v) {
+        return _mm256_movemask_epi8(v);
+    }
+    __attribute__((target("avx2"))) static Vector inRange(Vector v, char low, char count) {
+        Vector offset = _mm256_sub_epi8(v, _mm256_set1_epi8(low));
+        return _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(count - 1)), offset);
+    }
+    __attribute__((target("avx2"))) static Vector space(Vector v) {
+        return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), inRange(v, '\t', 5));
+    }
+    __attribute__((target("avx2"))) static Vector digit(Vector v) {
+        return inRange(v, '0', 10);
+    }
+    __attribute__((target("avx2"))) static Vector alnum(Vector v) {
+        return _mm256_or_si256(digit(v), inRange(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 26));
+    }
+};
+
+// Whole vectors are only loaded while they fit before end, the rest of the
+// buffer is scanned a byte at a time
+#define DEFINE_SKIP(Isa, Class, classes, target)                                                                       \
+    target static const char *skip##Class##Isa(const char *cur, const char *end) {                                     \
+        while (end - cur >= Isa::width) {                                                                              \
+            uint32_t outside = ~Isa::mask(Isa::Class(Isa::load(cur)));                                                 \
+            if constexpr (Isa::width < 32)                                                                             \
+                outside &= (1u << Isa::width) - 1;                                                                     \
+            if (outside != 0)                                                                                          \
+                return cur + __builtin_ctz(outside);                                                                   \
+            cur += Isa::width;                                                                                         \
+        }                                                                                                              \
+        return skipScalar(cur, end, classes);                                                                          \
+    }
+
+DEFINE_SKIP(Sse2, space, CharSpace, )
+DEFINE_SKIP(Sse2, alnum, CharAlnum, )
+DEFINE_SKIP(Sse2, digit, CharDigit, )
+DEFINE_SKIP(Avx2, space, CharSpace, __attribute__((target("avx2"))))
+DEFINE_SKIP(Avx2, alnum, CharAlnum, __attribute__((target("avx2"))))
+DEFINE_SKIP(Avx2, digit, CharDigit, __attribute__((target("avx2"))))
+
+#undef DEFINE_SKIP
+
+using Scanner = const char *(*)(const char *, const char *);
+
+struct Scanners {
+    Scanner space, alnum, digit;
+};
+
+// Picked once at startup, SSE2 is always there on x86-64
+static Scanners selectScanners() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return {skipspaceAvx2, skipalnumAvx2, skipdigitAvx2};
+    return {skipspaceSse2, skipalnumSse2, skipdigitSse2};
+}
+
+static const Scanners scanners = selectScanners();
+
+const char *skipSpace(const char *cur, const char *end) {
+    return scanners.space(cur, end);
+}
+
+const char *skipAlnum(const char *cur, const char *end) {
+    return scanners.alnum(cur, end);
+}
+
+const char *skipDigits(const char *cur, const char *end) {
+    return scanners.digit(cur, end);
+}
+
+#else
+
+const char *skipSpace(const char *cur, const char *end) {
+    return skipScalar(cur, end, CharSpace);
+}
+
+const char *skipAlnum(const char *cur, const char *end) {
+    return skipScalar(cur, end, CharAlnum);
+}
+
+const char *skipDigits(const char *cur, const char *end) {
+    return skipScalar(cur, end, CharDigit);
+}
+
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Character classes of the lexer, for plain ASCII without regard to the
+// locale. Bytes outside of ASCII belong to no class.
+enum CharClass : uint8_t {
+    CharSpace = 1,
+    CharDigit = 2,
+    CharLetter = 4,
+    CharAlnum = CharDigit | CharLetter,
+};
+
+extern const std::array<uint8_t, 256> charClasses;
+
+inline bool isCharClass(char c, uint8_t classes) {
+    return charClasses[static_cast<unsigned char>(c)] & classes;
+}
+
+// Each scanner returns the first position in [cur, end) whose character is
+// not in the class, or end. They look at 16 or 32 bytes at a time with SSE2 or
+// AVX2, whichever the host supports, and never read past end.
+const char *skipSpace(const char *cur, const char *end);
+const char *skipAlnum(const char *cur, const char *end);
+const char *skipDigits(const char *cur, const char *end);
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cassert>
+#include <vector>
+
+#include "token.hpp"
+
+// Maps symbols to whatever they are bound to in the innermost enclosing scope.
+// Lookups are a single array index, and leaving a scope undoes every binding
+// that was made inside of it.
+template <typename T> class ScopedSymbolTable {
+  public:
+    void pushScope() {
+        scopeStarts.push_back(undoLog.size());
+    }
+
+    void popScope() {
+        assert(!scopeStarts.empty());
+        while (undoLog.size() > scopeStarts.back()) {
+            bindings[undoLog.back().symbol] = undoLog.back().previous;
+            undoLog.pop_back();
+        }
+        scopeStarts.pop_back();
+    }
+
+    // Returns false if the symbol is already declared in the current scope.
+    // Declarations in an inner scope shadow those of the outer scopes.
+    [[nodiscard]] bool declare(Symbol symbol, T value) {
+        if (symbol >= bindings.size())
+            bindings.resize(symbol + 1);
+
+        Binding &binding = bindings[symbol];
+        if (binding.bound && binding.depth == scopeStarts.size())
+            return false;
+
+        undoLog.push_back({symbol, binding});
+        binding = {value, static_cast<unsigned>(scopeStarts.size()), true};
+        return true;
+    }
+
+    // Rebinds the symbol in the innermost scope that declared it, returns
+    // false if it isn't declared at all
+    [[nodiscard]] bool assign(Symbol symbol, T value) {
+        if (symbol >= bindings.size() || !bindings[symbol].bound)
+            return false;
+        bindings[symbol].value = value;
+        return true;
+    }
+
+    // Returns a default constructed T if the symbol is not bound in any scope
+    T lookup(Symbol symbol) const {
+        if (symbol >= bindings.size() || !bindings[symbol].bound)
+            return T();
+        return bindings[symbol].value;
+    }
+
+  private:
+    struct Binding {
+        T value = T();
+        unsigned depth = 0;
+        bool bound = false;
+    };
+    struct UndoEntry {
+        Symbol symbol;
+        Binding previous;
+    };
+
+    std::vector<Binding> bindings;
+    std::vector<UndoEntry> undoLog;
+    std::vector<size_t> scopeStarts;
+};
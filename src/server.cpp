@@ -0,0 +1,191 @@
+#include "remote.hpp"
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace remote {
+
+static void flushAll() {
+    std::cout.flush();
+    std::cerr.flush();
+    llvm::outs().flush();
+    llvm::errs().flush();
+    fflush(stdout);
+    fflush(stderr);
+}
+
+static std::string readFile(FILE *file) {
+    std::string contents;
+    rewind(file);
+    char buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        contents.append(buffer, count);
+    }
+    return contents;
+}
+
+// Runs the handler with stdout and stderr going to temporary files, so
+// everything the compiler prints ends up in the response, no matter how it
+// was printed. Only called in a worker, which exits afterwards, so the
+// directory, environment and streams of the client are never restored.
+static void handleRequest(const Request &request, const RequestHandler &handler, Response &response) {
+    FILE *out = tmpfile(), *err = tmpfile();
+    if (out == nullptr || err == nullptr) {
+        response.status = EXIT_FAILURE;
+        response.err = std::string("kopic server: unable to create temporary file: ") + strerror(errno) + "\n";
+        if (out != nullptr)
+            fclose(out);
+        if (err != nullptr)
+            fclose(err);
+        return;
+    }
+
+    flushAll();
+    dup2(fileno(out), STDOUT_FILENO);
+    dup2(fileno(err), STDERR_FILENO);
+
+    if (request.cacheDirectory.empty()) {
+        unsetenv("KOPI_CACHE_DIR");
+    } else {
+        setenv("KOPI_CACHE_DIR", request.cacheDirectory.c_str(), 1);
+    }
+    if (chdir(request.workingDirectory.c_str()) != 0) {
+        std::cerr << "kopic server: unable to enter " << request.workingDirectory << ": " << strerror(errno)
+                  << std::endl;
+        response.status = EXIT_FAILURE;
+    } else {
+        response.status = handler(request.args, response.outputs);
+    }
+
+    flushAll();
+    response.out = readFile(out);
+    response.err = readFile(err);
+    fclose(out);
+    fclose(err);
+}
+
+// Reads, compiles and answers the request on a connection. Runs in a process
+// of its own, forked for the connection.
+static void runWorker(int connection, const RequestHandler &handler) {
+    Request request;
+    if (readRequest(connection, request)) {
+        Response response;
+        handleRequest(request, handler, response);
+        writeResponse(connection, response);
+    }
+    close(connection);
+}
+
+// Only a socket that was left behind by a server that is gone may be replaced.
+// Anything else at the path, like a source file given by mistake or the socket
+// of a server that is still running, is left alone.
+static bool removeStaleSocket(const std::string &socketPath, const sockaddr_un &address) {
+    struct stat status;
+    if (lstat(socketPath.c_str(), &status) != 0)
+        return errno == ENOENT;
+    if (!S_ISSOCK(status.st_mode)) {
+        std::cerr << socketPath << " already exists and is not a socket" << std::endl;
+        return false;
+    }
+
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe < 0) {
+        std::cerr << "Unable to create socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+    bool live = connect(probe, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0;
+    close(probe);
+    if (live) {
+        std::cerr << "A kopic server is already listening on " << socketPath << std::endl;
+        return false;
+    }
+    if (unlink(socketPath.c_str()) != 0 && errno != ENOENT) {
+        std::cerr << "Unable to remove stale socket " << socketPath << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int runServer(const std::string &socketPath, const RequestHandler &handler) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path is too long: " << socketPath << std::endl;
+        return EXIT_FAILURE;
+    }
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    if (!removeStaleSocket(socketPath, address))
+        return EXIT_FAILURE;
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::cerr << "Unable to create socket: " << strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0) {
+        std::cerr << "Unable to listen on " << socketPath << ": " << strerror(errno) << std::endl;
+        close(listener);
+        return EXIT_FAILURE;
+    }
+
+    // A client that goes away before reading its response must not take the
+    // server down with it. Workers are reaped by the system.
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGCHLD, SIG_IGN);
+
+    // Every connection is handled by a worker forked for it, so requests run
+    // at the same time even though the command line options they are parsed
+    // into are global, and each gets the working directory and output streams
+    // of its client. Workers start out with everything the server set up.
+    // The server itself never compiles, so it has no other threads to lose
+    // when forking.
+    for (;;) {
+        int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Unable to accept connection: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        flushAll();
+        pid_t worker = fork();
+        if (worker == 0) {
+            // Workers wait for the linkers they run themselves
+            signal(SIGCHLD, SIG_DFL);
+            close(listener);
+            runWorker(connection, handler);
+            _exit(EXIT_SUCCESS);
+        }
+        if (worker < 0) {
+            std::string message = std::string("kopic server: unable to start a worker: ") + strerror(errno) + "\n";
+            Request request;
+            if (readRequest(connection, request)) {
+                Response response;
+                response.status = EXIT_FAILURE;
+                response.err = message;
+                writeResponse(connection, response);
+            }
+        }
+        close(connection);
+    }
+
+    close(listener);
+    unlink(socketPath.c_str());
+    return EXIT_FAILURE;
+}
+
+} // namespace remote
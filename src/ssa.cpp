@@ -0,0 +1,108 @@
+#include "ssa.hpp"
+
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Constants.h>
+
+void SSABuilder::clear() {
+    types.clear();
+    currentDefs.clear();
+    sealedBlocks.clear();
+    incompletePhis.clear();
+}
+
+SSABuilder::Variable SSABuilder::addVariable(llvm::Type *type) {
+    types.push_back(type);
+    return types.size() - 1;
+}
+
+void SSABuilder::write(Variable var, llvm::BasicBlock *block, llvm::Value *value) {
+    currentDefs[{var, block}] = value;
+}
+
+llvm::Value *SSABuilder::read(Variable var, llvm::BasicBlock *block) {
+    auto it = currentDefs.find({var, block});
+    if (it != currentDefs.end())
+        return it->second;
+    return readRecursive(var, block);
+}
+
+llvm::Value *SSABuilder::readRecursive(Variable var, llvm::BasicBlock *block) {
+    llvm::Value *value;
+    if (!sealedBlocks.contains(block)) {
+        // More predecessors may follow, so the operands are only filled in
+        // once the block is sealed
+        llvm::PHINode *phi = addPhi(var, block);
+        incompletePhis[block].push_back({var, phi});
+        value = phi;
+    } else if (llvm::BasicBlock *pred = block->getSinglePredecessor()) {
+        value = read(var, pred);
+    } else if (llvm::pred_empty(block)) {
+        // Read before any write, like a variable in its own initializer
+        value = llvm::UndefValue::get(types[var]);
+    } else {
+        // The phi is written first to break cycles through loops
+        llvm::PHINode *phi = addPhi(var, block);
+        write(var, block, phi);
+        value = addPhiOperands(var, phi);
+    }
+    write(var, block, value);
+    return value;
+}
+
+llvm::PHINode *SSABuilder::addPhi(Variable var, llvm::BasicBlock *block) {
+    if (block->empty())
+        return llvm::PHINode::Create(types[var], 2, "", block);
+    return llvm::PHINode::Create(types[var], 2, "", &block->front());
+}
+
+llvm::Value *SSABuilder::addPhiOperands(Variable var, llvm::PHINode *phi) {
+    for (llvm::BasicBlock *pred : llvm::predecessors(phi->getParent())) {
+        phi->addIncoming(read(var, pred), pred);
+    }
+    return tryRemoveTrivialPhi(phi);
+}
+
+// A phi whose operands are all the same value, or the phi itself, is replaced
+// by that value. Phis that used it may become trivial in turn.
+llvm::Value *SSABuilder::tryRemoveTrivialPhi(llvm::PHINode *phi) {
+    llvm::Value *same = nullptr;
+    for (llvm::Value *operand : phi->incoming_values()) {
+        if (operand == same || operand == phi)
+            continue;
+        if (same != nullptr)
+            return phi;
+        same = operand;
+    }
+    if (same == nullptr) {
+        // Unreachable, or only reachable from itself
+        same = llvm::UndefValue::get(phi->getType());
+    }
+
+    // Removing one of the users can remove others, the handles are cleared
+    // when that happens
+    llvm::SmallVector<llvm::WeakVH, 4> phiUsers;
+    for (llvm::User *user : phi->users()) {
+        if (user != phi && llvm::isa<llvm::PHINode>(user))
+            phiUsers.push_back(user);
+    }
+    phi->replaceAllUsesWith(same);
+    phi->eraseFromParent();
+
+    for (llvm::WeakVH &user : phiUsers) {
+        if (auto *userPhi = llvm::dyn_cast_or_null<llvm::PHINode>(user))
+            tryRemoveTrivialPhi(userPhi);
+    }
+    return same;
+}
+
+void SSABuilder::seal(llvm::BasicBlock *block) {
+    auto it = incompletePhis.find(block);
+    if (it != incompletePhis.end()) {
+        auto phis = std::move(it->second);
+        incompletePhis.erase(it);
+        for (auto [var, phi] : phis) {
+            addPhiOperands(var, phi);
+        }
+    }
+    sealedBlocks.insert(block);
+}
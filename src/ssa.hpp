@@ -0,0 +1,46 @@
+#pragma once
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/ValueHandle.h>
+
+#include <utility>
+#include <vector>
+
+// Builds SSA form for local variables directly while the IR is emitted,
+// following "Simple and Efficient Construction of Static Single Assignment
+// Form" by Braun et al. Every assignment records the value the variable has
+// at the end of the current block, and reads look the value up through the
+// predecessors of the block, adding phis where paths merge. No allocas are
+// needed, so even -O0 code keeps variables in registers.
+class SSABuilder {
+  public:
+    using Variable = unsigned;
+
+    // Starts over for the next function
+    void clear();
+
+    Variable addVariable(llvm::Type *type);
+    void write(Variable var, llvm::BasicBlock *block, llvm::Value *value);
+    llvm::Value *read(Variable var, llvm::BasicBlock *block);
+
+    // Declares that every predecessor of the block has been emitted. Until
+    // then reads in the block only get placeholder phis, which are completed
+    // here.
+    void seal(llvm::BasicBlock *block);
+
+  private:
+    llvm::Value *readRecursive(Variable var, llvm::BasicBlock *block);
+    llvm::PHINode *addPhi(Variable var, llvm::BasicBlock *block);
+    llvm::Value *addPhiOperands(Variable var, llvm::PHINode *phi);
+    llvm::Value *tryRemoveTrivialPhi(llvm::PHINode *phi);
+
+    std::vector<llvm::Type *> types;
+    // Tracking handles follow the replacement when a trivial phi is removed
+    llvm::DenseMap<std::pair<Variable, llvm::BasicBlock *>, llvm::WeakTrackingVH> currentDefs;
+    llvm::DenseSet<llvm::BasicBlock *> sealedBlocks;
+    llvm::DenseMap<llvm::BasicBlock *, llvm::SmallVector<std::pair<Variable, llvm::PHINode *>, 4>> incompletePhis;
+};
@@ -0,0 +1,83 @@
+#include "timing.hpp"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/raw_os_ostream.h>
+
+#include <optional>
+
+static const char *const phaseNames[][2] = {
+    {"lex", "Lexing (as a separate pass)"},
+    {"parse", "Parsing (including lexing)"},
+    {"consteval", "Constant folding"},
+    {"emit", "AST to IR"},
+    {"verify", "IR verification"},
+    {"optimize", "IR optimization"},
+    {"codegen", "Machine code generation"},
+    {"write", "Object file write"},
+};
+static_assert(sizeof(phaseNames) / sizeof(phaseNames[0]) == PhaseTimers::NumPhases, "Phase without a name");
+
+PhaseTimers::PhaseTimers(bool enabled) : enabled(enabled), group("kopic", "kopic compilation phases") {
+    if (!enabled)
+        return;
+    for (unsigned i = 0; i < NumPhases; i++) {
+        timers[i].init(phaseNames[i][0], phaseNames[i][1], group);
+    }
+}
+
+void PhaseTimers::printStats(std::ostream &os) const {
+    if (!enabled)
+        return;
+    for (unsigned i = 0; i < NumPhases; i++) {
+        if (!timers[i].hasTriggered())
+            continue;
+        llvm::TimeRecord time = timers[i].getTotalTime();
+        os << "time." << phaseNames[i][0] << ".wall " << time.getWallTime() << '\n';
+        os << "time." << phaseNames[i][0] << ".cpu " << time.getProcessTime() << '\n';
+    }
+}
+
+void PhaseTimers::print(std::ostream &os) {
+    if (!enabled)
+        return;
+    llvm::raw_os_ostream out(os);
+    // Resetting keeps the group from printing everything again to stderr
+    // when it is destroyed
+    group.print(out, /*ResetAfterPrint=*/true);
+}
+
+// Only set before the worker threads start, and cleared once they are done
+// and the trace is written, so that a server only traces the requests that
+// asked for it
+static std::optional<unsigned> traceGranularity;
+
+void timeTraceInitialize(unsigned granularityUs) {
+    traceGranularity = granularityUs;
+    llvm::timeTraceProfilerInitialize(granularityUs, "kopic");
+}
+
+bool timeTraceWrite(const std::string &filename, std::ostream &diag) {
+    std::error_code errCode;
+    llvm::raw_fd_ostream os(filename, errCode, llvm::sys::fs::OF_Text);
+    if (errCode) {
+        diag << "Unable to open " << filename << ": " << errCode.message() << std::endl;
+    } else {
+        llvm::timeTraceProfilerWrite(os);
+    }
+    llvm::timeTraceProfilerCleanup();
+    traceGranularity.reset();
+    return !errCode;
+}
+
+ThreadTimeTrace::ThreadTimeTrace() {
+    if (traceGranularity && !llvm::timeTraceProfilerEnabled()) {
+        llvm::timeTraceProfilerInitialize(*traceGranularity, "kopic");
+        ownsProfiler = true;
+    }
+}
+
+ThreadTimeTrace::~ThreadTimeTrace() {
+    if (ownsProfiler)
+        llvm::timeTraceProfilerFinishThread();
+}
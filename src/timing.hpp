@@ -0,0 +1,49 @@
+#pragma once
+
+#include <llvm/Support/Timer.h>
+
+#include <ostream>
+#include <string>
+
+// Wall and CPU time spent in each phase of one compilation, for -ftime-report.
+// When timing is disabled every timer is null, which llvm::TimeRegion ignores.
+class PhaseTimers {
+  public:
+    enum Phase { Lex, Parse, ConstEval, Emit, Verify, Optimize, Codegen, WriteObject, NumPhases };
+
+    explicit PhaseTimers(bool enabled);
+
+    llvm::Timer *get(Phase phase) {
+        return enabled ? &timers[phase] : nullptr;
+    }
+
+    // Prints a table of the phases that ran, if timing is enabled
+    void print(std::ostream &os);
+    // Prints the same times as "time.<phase>.wall" and ".cpu" lines in
+    // seconds, in the format of --stats. Must come before print().
+    void printStats(std::ostream &os) const;
+
+  private:
+    bool enabled;
+    llvm::TimerGroup group;
+    llvm::Timer timers[NumPhases];
+};
+
+// Starts recording -ftime-trace events for the calling thread. Must be called
+// before any other thread that should be traced is started.
+void timeTraceInitialize(unsigned granularityUs);
+// Writes the events of all threads as Chrome trace JSON and stops recording,
+// for the calling thread and for threads started afterwards
+bool timeTraceWrite(const std::string &filename, std::ostream &diag);
+
+// LLVM's time profiler records each thread on its own, so work that may run
+// on other threads than the traced main thread keeps one of these in scope
+// while it runs. Does nothing if tracing is disabled.
+class ThreadTimeTrace {
+  public:
+    ThreadTimeTrace();
+    ~ThreadTimeTrace();
+
+  private:
+    bool ownsProfiler = false;
+};
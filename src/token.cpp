@@ -1,87 +1,192 @@
 #include "token.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <utility>
 
-Token TokenReader::next() {
-    int tokenChar;
-    std::string word;
+#include "scan.hpp"
 
-    tokenChar = infile.get();
+struct Keyword {
+    std::string_view text;
+    TokenType type;
+};
 
-    do {
-        while (tokenChar == '/' && infile.peek() == '/') {
-            skipUntil('\n');
-            tokenChar = infile.get();
-        }
+static constexpr Keyword keywords[] = {
+    {"public", TokenType::Public},
+    {"protected", TokenType::Protected},
+    {"private", TokenType::Private},
+    {"int", TokenType::Int},
+    {"return", TokenType::Return},
+    {"if", TokenType::If},
+    {"else", TokenType::Else},
+    {"while", TokenType::While},
+    {"for", TokenType::For},
+};
 
-        // Ignore whitespace characters
-        while (isspace(tokenChar))
-            tokenChar = infile.get();
+// Perfect hash of the keywords. If a new keyword collides with another one,
+// the static_assert below fails and the hash needs to be changed.
+static constexpr size_t keywordTableSize = 32;
+static constexpr size_t keywordHash(std::string_view word) {
+    return (word.size() + static_cast<unsigned char>(word.front()) + static_cast<unsigned char>(word.back()))
+           % keywordTableSize;
+}
 
-        if (tokenChar == EOF)
-            return {TokenType::EoF, "_done_"};
-    } while (tokenChar == '/' && infile.peek() == '/');
+struct KeywordTable {
+    Keyword slots[keywordTableSize] = {};
+    bool collision = false;
 
-    // Read keywords and identifiers
-    if (isalpha(tokenChar)) {
-        while (isalnum(tokenChar)) {
-            word += tokenChar;
-            tokenChar = infile.get();
+    constexpr KeywordTable() {
+        for (const Keyword &keyword : keywords) {
+            Keyword &slot = slots[keywordHash(keyword.text)];
+            collision = collision || !slot.text.empty();
+            slot = keyword;
         }
+    }
+};
+
+static constexpr KeywordTable keywordTable;
+static_assert(!keywordTable.collision, "Keywords must hash to different slots");
+
+// Returns the keyword's token type, or Identifier if the word isn't one
+static TokenType classifyWord(std::string_view word) {
+    const Keyword &slot = keywordTable.slots[keywordHash(word)];
+    return slot.text == word ? slot.type : TokenType::Identifier;
+}
+
+// Tokens that are a single character, looked up by that character
+static constexpr std::pair<char, TokenType> punctuators[] = {
+    {'(', TokenType::OpenBracket}, {')', TokenType::CloseBracket}, {'{', TokenType::OpenBrace},
+    {'}', TokenType::CloseBrace},  {';', TokenType::Semicolon},    {',', TokenType::Comma},
+    {'@', TokenType::At},          {'+', TokenType::Plus},         {'-', TokenType::Minus},
+    {'*', TokenType::Multiply},    {'/', TokenType::Divide},       {'=', TokenType::Assign},
+    {'<', TokenType::Less},        {'>', TokenType::Greater},
+};
+
+// Tokens of two characters, which are all a character followed by '='
+static constexpr std::pair<char, TokenType> equalsOperators[] = {
+    {'=', TokenType::Equal},
+    {'!', TokenType::NotEqual},
+    {'<', TokenType::LessEqual},
+    {'>', TokenType::GreaterEqual},
+};
+
+static constexpr std::array<TokenType, 256> makePunctuatorTypes() {
+    std::array<TokenType, 256> types = {};
+    for (TokenType &type : types) {
+        type = TokenType::Invalid;
+    }
+    for (const auto &[c, type] : punctuators) {
+        types[static_cast<unsigned char>(c)] = type;
+    }
+    return types;
+}
+
+static constexpr std::array<TokenType, 256> punctuatorTypes = makePunctuatorTypes();
+
+bool SourceBuffer::open(const std::string &name) {
+    filename = name;
+
+    auto fileOrErr = llvm::MemoryBuffer::getFileOrSTDIN(name, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!fileOrErr) {
+        diag << "Unable to open " << name << ": " << fileOrErr.getError().message() << std::endl;
+        return false;
+    }
+    buffer = std::move(*fileOrErr);
 
-        infile.unget();
-        if (word == "public") {
-            return {TokenType::Public, word};
+    // Tokens store 32-bit offsets into the buffer
+    if (buffer->getBufferSize() > std::numeric_limits<uint32_t>::max()) {
+        diag << name << " is too large to compile" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void SourceBuffer::location(uint32_t offset, unsigned *line, unsigned *column) const {
+    if (lineStarts.empty()) {
+        lineStarts.push_back(0);
+        for (const char *pos = begin(); (pos = static_cast<const char *>(memchr(pos, '\n', end() - pos))); pos++) {
+            lineStarts.push_back(pos + 1 - begin());
         }
-        if (word == "int") {
-            return {TokenType::Int, word};
+    }
+
+    auto next = std::upper_bound(lineStarts.begin(), lineStarts.end(), offset);
+    *line = next - lineStarts.begin();
+    *column = offset - next[-1] + 1;
+}
+
+std::ostream &SourceBuffer::error(uint32_t offset) const {
+    unsigned line, column;
+    location(offset, &line, &column);
+    return diag << filename << ':' << line << ':' << column << ": error: ";
+}
+
+Token TokenReader::lex() {
+    const char *end = src.end();
+
+    // Ignore whitespace characters and comments
+    for (;;) {
+        // Most runs of whitespace are a single space, those don't need the
+        // vector code
+        if (cur != end && isCharClass(*cur, CharSpace))
+            cur = skipSpace(cur + 1, end);
+        if (end - cur >= 2 && cur[0] == '/' && cur[1] == '/') {
+            skipUntil('\n');
+            continue;
         }
-        if (word == "return") {
-            return {TokenType::Return, word};
+        break;
+    }
+
+    const char *start = cur;
+    if (cur == end)
+        return makeToken(TokenType::EoF, start);
+
+    numLexed++;
+
+    // Read keywords and identifiers
+    if (isCharClass(*cur, CharLetter)) {
+        cur++;
+        if (cur != end && isCharClass(*cur, CharAlnum))
+            cur = skipAlnum(cur + 1, end);
+
+        std::string_view word(start, cur - start);
+        TokenType type = classifyWord(word);
+        if (type != TokenType::Identifier) {
+            return makeToken(type, start);
         }
 
-        return {TokenType::Identifier, word};
+        Token tok = makeToken(TokenType::Identifier, start);
+        tok.symbol = strings.intern(word);
+        return tok;
     }
 
-    if (isdigit(tokenChar)) {
-        while (isdigit(tokenChar)) {
-            word += tokenChar;
-            tokenChar = infile.get();
+    if (isCharClass(*cur, CharDigit)) {
+        cur++;
+        if (cur != end && isCharClass(*cur, CharDigit))
+            cur = skipDigits(cur + 1, end);
+        return makeToken(TokenType::Number, start);
+    }
+
+    if (end - cur >= 2 && cur[1] == '=') {
+        for (const auto &[c, type] : equalsOperators) {
+            if (*cur == c) {
+                cur += 2;
+                return makeToken(type, start);
+            }
         }
-        infile.unget();
-        return {TokenType::Number, word};
     }
 
-    switch (tokenChar) {
-    case '(':
-        return {TokenType::OpenBracket, "("};
-    case ')':
-        return {TokenType::CloseBracket, ")"};
-    case '{':
-        return {TokenType::OpenBrace, "{"};
-    case '}':
-        return {TokenType::CloseBrace, "}"};
-    case ';':
-        return {TokenType::Semicolon, ";"};
-    case ',':
-        return {TokenType::Comma, ","};
-    case '+':
-        return {TokenType::Plus, "+"};
-    case '-':
-        return {TokenType::Minus, "-"};
-    case '*':
-        return {TokenType::Multiply, "*"};
-    case '/':
-        return {TokenType::Divide, "/"};
-    case '=':
-        return {TokenType::Assign, "="};
-    default:
-        std::cerr << "Unrecognized token: '" << tokenChar << "' at " << infile.tellg() << std::endl;
-        return {TokenType::Invalid, ""};
+    TokenType type = punctuatorTypes[static_cast<unsigned char>(*cur++)];
+    if (type == TokenType::Invalid) {
+        src.error(start - src.begin()) << "Unrecognized token '" << *start << '\'' << std::endl;
     }
+    return makeToken(type, start);
 }
 
-bool TokenReader::expectNext(TokenType expectedType, Token *result) {
+const char *tokenTypeName(TokenType type) {
     static const char *tokenNames[] = {
         // clang-format off
         "end of file",
@@ -92,24 +197,51 @@ bool TokenReader::expectNext(TokenType expectedType, Token *result) {
         "}",
         ";",
         ",",
+        "@",
         "+",
         "-",
         "*",
         "/",
         "=",
+        "==",
+        "!=",
+        "<",
+        "<=",
+        ">",
+        ">=",
         "public",
+        "protected",
+        "private",
         "int",
         "return",
+        "if",
+        "else",
+        "while",
+        "for",
         "identifier",
         "number"
         // clang-format on
     };
     static_assert(sizeof(tokenNames) / sizeof(*tokenNames) == static_cast<size_t>(TokenType::_NumTypes));
 
+    return tokenNames[static_cast<int>(type)];
+}
+
+Token TokenReader::next() {
+    fill(1);
+    Token tok = lookahead[lookaheadStart];
+    lookaheadStart = (lookaheadStart + 1) % maxLookahead;
+    lookaheadCount--;
+    if (tok.type != TokenType::EoF)
+        numConsumed++;
+    return tok;
+}
+
+bool TokenReader::expectNext(TokenType expectedType, Token *result) {
     Token tok = next();
     if (tok.type != expectedType) {
-        std::cerr << "Expected token '" << tokenNames[static_cast<int>(expectedType)] << "', got '"
-                  << tokenNames[static_cast<int>(tok.type)] << '\'' << std::endl;
+        src.error(tok.offset) << "Expected token '" << tokenTypeName(expectedType) << "', got '"
+                              << tokenTypeName(tok.type) << '\'' << std::endl;
         return false;
     }
     if (result != nullptr) {
@@ -118,17 +250,22 @@ bool TokenReader::expectNext(TokenType expectedType, Token *result) {
     return true;
 }
 
-TokenType TokenReader::peek() {
-    std::streampos pos = infile.tellg();
-    Token t = next();
-    infile.seekg(pos);
-    return t.type;
+TokenType TokenReader::peek(unsigned ahead) {
+    assert(ahead < maxLookahead);
+    fill(ahead + 1);
+    return lookahead[(lookaheadStart + ahead) % maxLookahead].type;
 }
 
-void TokenReader::skipUntil(char c) {
-    int read;
-    while ((read = infile.get()) != c) {
-        if (infile.peek() == EOF)
-            break;
+void TokenReader::fill(unsigned count) {
+    // Once the end of the file is reached lex() keeps returning EoF tokens
+    while (lookaheadCount < count) {
+        lookahead[(lookaheadStart + lookaheadCount) % maxLookahead] = lex();
+        lookaheadCount++;
     }
 }
+
+void TokenReader::skipUntil(char c) {
+    // The C library's memchr is already vectorized, with AVX2 where available
+    const void *found = memchr(cur, c, src.end() - cur);
+    cur = found != nullptr ? static_cast<const char *>(found) + 1 : src.end();
+}
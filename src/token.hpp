@@ -1,6 +1,15 @@
 #pragma once
 
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
 #include <string>
+#include <string_view>
+#include <vector>
 
 enum class TokenType {
     EoF,
@@ -13,6 +22,7 @@ enum class TokenType {
     CloseBrace,
     Semicolon,
     Comma,
+    At,
 
     // Operators
     Plus,
@@ -20,11 +30,23 @@ enum class TokenType {
     Multiply,
     Divide,
     Assign,
+    Equal,
+    NotEqual,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
 
     // Keywords
     Public,
+    Protected,
+    Private,
     Int,
     Return,
+    If,
+    Else,
+    While,
+    For,
 
     // Parts
     Identifier,
@@ -33,25 +55,134 @@ enum class TokenType {
     _NumTypes
 };
 
+const char *tokenTypeName(TokenType type);
+
+// Identifiers are interned while lexing, so later stages can compare and look
+// them up by integer instead of by string.
+using Symbol = uint32_t;
+
+// A token is only a span into its SourceBuffer, so it is cheap to copy around.
+// Use SourceBuffer::text() to get at the characters it covers.
 struct Token {
     TokenType type;
-    std::string contents;
+    uint32_t offset;
+    uint32_t length;
+    Symbol symbol; // Only set for identifiers
+};
+
+// The entire contents of one source file. Files are memory-mapped where
+// possible and stdin ("-") is read in a single bulk read. The buffer must
+// outlive every token and AST node that refers to it.
+class SourceBuffer {
+  public:
+    // Diagnostics about this file are written to the given stream
+    explicit SourceBuffer(std::ostream &diag) : diag(diag) {
+    }
+
+    [[nodiscard]] bool open(const std::string &filename);
+
+    const std::string &name() const {
+        return filename;
+    }
+    const char *begin() const {
+        return buffer->getBufferStart();
+    }
+    const char *end() const {
+        return buffer->getBufferEnd();
+    }
+    std::string_view text(const Token &tok) const {
+        return std::string_view(begin() + tok.offset, tok.length);
+    }
+
+    // Line and column numbers are not tracked while lexing, they are only
+    // worked out here when a diagnostic needs them. The first call indexes
+    // the start of every line.
+    void location(uint32_t offset, unsigned *line, unsigned *column) const;
+
+    // Prints a "file:line:column: error: " prefix and returns the stream to
+    // write the rest of the message to.
+    std::ostream &error(uint32_t offset) const;
+    // For messages that are not about a specific location in the file
+    std::ostream &diagnostics() const {
+        return diag;
+    }
+
+  private:
+    std::ostream &diag;
+    std::string filename;
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
+    mutable std::vector<uint32_t> lineStarts;
+};
+
+// Maps every distinct identifier to a dense symbol ID. The strings are not
+// copied, they point into the SourceBuffer they were lexed from.
+class StringTable {
+  public:
+    Symbol intern(llvm::StringRef str) {
+        auto [it, inserted] = symbols.try_emplace(str, names.size());
+        if (inserted)
+            names.push_back(str);
+        return it->second;
+    }
+
+    llvm::StringRef name(Symbol symbol) const {
+        return names[symbol];
+    }
+    size_t size() const {
+        return names.size();
+    }
+
+  private:
+    llvm::DenseMap<llvm::StringRef, Symbol> symbols;
+    std::vector<llvm::StringRef> names;
 };
 
 class TokenReader {
   public:
-    explicit TokenReader(std::istream &inf) : infile(inf) {
+    TokenReader(const SourceBuffer &src, StringTable &strings) : src(src), strings(strings), cur(src.begin()) {
     }
 
     Token next();
     // Gets the next token, and expects it to be a certain type.
     [[nodiscard]] bool expectNext(TokenType type, Token *result = nullptr);
 
-    // Previews the type of the next token without advancing the parser
-    [[nodiscard]] TokenType peek();
+    // Previews the type of an upcoming token without advancing the parser.
+    // Up to maxLookahead tokens can be previewed, each is only lexed once.
+    [[nodiscard]] TokenType peek(unsigned ahead = 0);
+
+    const SourceBuffer &source() const {
+        return src;
+    }
+
+    // The end of file token is not counted. Once the parser is done both
+    // counts should be equal, since every token is lexed exactly once.
+    uint64_t tokensLexed() const {
+        return numLexed;
+    }
+    uint64_t tokensConsumed() const {
+        return numConsumed;
+    }
+
+    static constexpr unsigned maxLookahead = 4;
 
   private:
+    Token lex();
+    void fill(unsigned count);
     void skipUntil(char c);
+    Token makeToken(TokenType type, const char *start) const {
+        return {type, static_cast<uint32_t>(start - src.begin()), static_cast<uint32_t>(cur - start), 0};
+    }
+
+    const SourceBuffer &src;
+    StringTable &strings;
+    const char *cur;
+
+    // Ring buffer of tokens that have been lexed but not consumed yet
+    static_assert((maxLookahead & (maxLookahead - 1)) == 0, "Lookahead size must be a power of two");
+    Token lookahead[maxLookahead];
+    unsigned lookaheadStart = 0;
+    unsigned lookaheadCount = 0;
 
-    std::istream &infile;
+    uint64_t numLexed = 0;
+    uint64_t numConsumed = 0;
 };
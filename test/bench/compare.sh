@@ -0,0 +1,41 @@
+#!/bin/sh
+# Compares two results files of run_bench.sh and fails if any metric got
+# worse by more than the threshold. Throughput is worse when it drops, all
+# other metrics when they grow. Phase times under 10ms are too noisy to judge.
+#
+# usage: compare.sh <baseline> <results> [threshold percent, default 10]
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 <baseline> <results> [threshold percent]" >&2
+    exit 1
+fi
+
+for f in "$1" "$2"; do
+    if [ ! -f "$f" ]; then
+        echo "$f not found, run make bench and make bench-baseline first" >&2
+        exit 1
+    fi
+done
+
+awk -v threshold="${3:-10}" '
+    FNR == NR { base[$1] = $2; next }
+    !($1 in base) || base[$1] == 0 { next }
+    {
+        change = ($2 - base[$1]) / base[$1] * 100
+        worse = $1 ~ /_per_s$/ ? -change : change
+        if ($1 ~ /\.time\./ && base[$1] < 0.01 && $2 < 0.01)
+            worse = 0
+
+        status = "ok"
+        if (worse > threshold) {
+            status = "REGRESSION"
+            regressions++
+        }
+        printf "%-36s %14g %14g %+8.1f%%  %s\n", $1, base[$1], $2, change, status
+    }
+    END {
+        if (regressions > 0) {
+            printf "%d metric(s) regressed by more than %g%%\n", regressions, threshold
+            exit 1
+        }
+    }' "$1" "$2"
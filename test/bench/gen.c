@@ -0,0 +1,94 @@
+// Writes a synthetic Kopi program to stdout for benchmarking the compiler.
+//
+// usage: gen <functions> <statements> <depth> <chain>
+//
+// Every function has the given number of statements, each initializing or
+// assigning a variable with a parenthesized expression nested depth levels
+// deep. Each function calls the one before it, starting a new call chain
+// every chain functions. The output only depends on the arguments.
+#include <stdio.h>
+#include <stdlib.h>
+
+static unsigned long long seed = 88172645463325252ull;
+
+static unsigned randomBelow(unsigned range) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (unsigned)(seed % range);
+}
+
+// Variables and parameters in scope are x, y and v0 to v<vars - 1>
+static void leaf(unsigned vars) {
+    switch (randomBelow(4)) {
+    case 0:
+        printf("%u", 1 + randomBelow(97));
+        break;
+    case 1:
+        printf(randomBelow(2) ? "x" : "y");
+        break;
+    default:
+        if (vars > 0) {
+            printf("v%u", randomBelow(vars));
+        } else {
+            printf("x");
+        }
+        break;
+    }
+}
+
+static void expr(unsigned depth, unsigned vars) {
+    static const char ops[] = "+-*";
+    if (depth == 0) {
+        leaf(vars);
+        return;
+    }
+
+    printf(randomBelow(4) == 0 ? "-(" : "(");
+    expr(depth - 1, vars);
+    // Only divide by literals, which are never zero
+    if (randomBelow(5) == 0) {
+        printf(" / %u)", 1 + randomBelow(13));
+    } else {
+        printf(" %c ", ops[randomBelow(3)]);
+        leaf(vars);
+        printf(")");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 5) {
+        fprintf(stderr, "usage: %s <functions> <statements> <depth> <chain>\n", argv[0]);
+        return 1;
+    }
+    unsigned functions = strtoul(argv[1], NULL, 10);
+    unsigned statements = strtoul(argv[2], NULL, 10);
+    unsigned depth = strtoul(argv[3], NULL, 10);
+    unsigned chain = strtoul(argv[4], NULL, 10);
+
+    for (unsigned f = 0; f < functions; f++) {
+        printf("public int f%u(int x, int y) {\n", f);
+        unsigned vars = 0;
+        for (unsigned s = 0; s < statements; s++) {
+            if (vars > 0 && randomBelow(4) == 0) {
+                printf("    v%u = ", randomBelow(vars));
+                expr(depth, vars);
+            } else {
+                printf("    int v%u = ", vars);
+                expr(depth, vars);
+                vars++;
+            }
+            printf(";\n");
+        }
+
+        printf("    return ");
+        expr(depth, vars);
+        if (chain > 1 && f % chain != 0) {
+            printf(" + f%u(y, ", f - 1);
+            leaf(vars);
+            printf(")");
+        }
+        printf(";\n}\n\n");
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+#!/bin/sh
+# Compiles generated Kopi programs and appends the throughput, peak memory
+# and time of each phase to the results file, as "<case>.<metric> <value>"
+# lines like those of kopic --stats. Each case runs $REPEAT times and the
+# fastest run is kept.
+#
+# usage: run_bench.sh <results file>
+set -e
+
+KOPIC=${KOPIC:-../../kopic}
+REPEAT=${REPEAT:-3}
+WORK=work
+RESULTS=$1
+
+if [ -z "$RESULTS" ]; then
+    echo "usage: $0 <results file>" >&2
+    exit 1
+fi
+
+mkdir -p $WORK
+: > "$RESULTS"
+
+# Sum of the phase wall times, the lexing pass of -ftime-report is extra work
+total_time() {
+    awk '$1 ~ /^time\..*\.wall$/ && $1 != "time.lex.wall" { t += $2 } END { print t + 0 }' "$1"
+}
+
+# usage: run_case <name> <functions> <statements> <depth> <chain>
+run_case() {
+    name=$1
+    shift
+    ./gen "$@" > $WORK/$name.kopi
+    lines=$(wc -l < $WORK/$name.kopi)
+
+    best=
+    run=0
+    while [ $run -lt "$REPEAT" ]; do
+        $KOPIC $KOPIFLAGS --stats -ftime-report -o $WORK/$name.o $WORK/$name.kopi 2> $WORK/$name.log
+        total=$(total_time $WORK/$name.log)
+        if [ -z "$best" ] || awk "BEGIN { exit !($total < $best) }"; then
+            best=$total
+            cp $WORK/$name.log $WORK/$name.best.log
+        fi
+        run=$((run + 1))
+    done
+
+    awk -v name=$name -v lines="$lines" -v total="$best" '
+        NF == 2 && $2 ~ /^[0-9.e+-]+$/ { stat[$1] = $2 }
+        END {
+            printf "%s.lines %d\n", name, lines
+            printf "%s.tokens %d\n", name, stat["tokens.lexed"]
+            printf "%s.total_s %g\n", name, total
+            if (total > 0) {
+                printf "%s.lines_per_s %d\n", name, lines / total
+                printf "%s.tokens_per_s %d\n", name, stat["tokens.lexed"] / total
+            }
+            printf "%s.peak_rss_kb %d\n", name, stat["memory.peak_rss_kb"]
+            printf "%s.ir_instructions %d\n", name, stat["ir.instructions"]
+            printf "%s.object_bytes %d\n", name, stat["object.bytes"]
+            split("lex parse consteval emit verify optimize codegen write", phases)
+            for (i = 1; i in phases; i++) {
+                key = "time." phases[i] ".wall"
+                if (key in stat)
+                    printf "%s.%s %g\n", name, key, stat[key]
+            }
+        }' $WORK/$name.best.log >> "$RESULTS"
+    echo "$name: $lines lines in ${best}s"
+}
+
+# Many small functions, long function bodies, deeply nested expressions and
+# long call chains
+run_case functions 20000 4 3 0
+run_case statements 20 5000 3 0
+run_case expressions 500 4 150 0
+run_case calls 20000 1 2 1000
@@ -0,0 +1,94 @@
+// Measures how fast the kernels in bench_kernels.kopi run compared to the same
+// kernels compiled by the C compiler. Each kernel is called in a loop with
+// inputs that change every iteration. After warming up, the loop is timed
+// for a number of rounds, and the mean time per call and its standard
+// deviation across rounds are reported.
+//
+// usage: bench <label for the kopic build>
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#define CALLS 5000000
+#define WARMUP_ROUNDS 2
+#define ROUNDS 10
+
+extern int poly(int);
+extern int dist2(int, int, int, int);
+extern int scale(int, int, int);
+extern int sumSquares(int, int, int);
+
+extern int c_poly(int);
+extern int c_dist2(int, int, int, int);
+extern int c_scale(int, int, int);
+extern int c_sumSquares(int, int, int);
+
+// Keeps the results of the loops alive
+static volatile int sink;
+
+static double nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Returns the mean time per call, C is the mean of the matching C kernel or 0
+static double report(const char *kernel, const char *build, const double *samples, double c) {
+    double mean = 0, variance = 0;
+    for (int i = 0; i < ROUNDS; i++) {
+        mean += samples[i] / ROUNDS;
+    }
+    for (int i = 0; i < ROUNDS; i++) {
+        variance += (samples[i] - mean) * (samples[i] - mean) / ROUNDS;
+    }
+
+    printf("%-12s %-10s %8.3f ns/call  +- %6.3f", kernel, build, mean, sqrt(variance));
+    if (c > 0) {
+        printf("  %5.2fx C", mean / c);
+    }
+    printf("\n");
+    return mean;
+}
+
+#define MEASURE(mean, kernel, build, c, call)                                                                          \
+    do {                                                                                                               \
+        double samples[ROUNDS];                                                                                        \
+        for (int round = -WARMUP_ROUNDS; round < ROUNDS; round++) {                                                    \
+            int acc = 0;                                                                                               \
+            double start = nowNs();                                                                                    \
+            for (int i = 0; i < CALLS; i++) {                                                                          \
+                acc += call;                                                                                           \
+            }                                                                                                          \
+            double perCall = (nowNs() - start) / CALLS;                                                                \
+            sink = acc;                                                                                                \
+            if (round >= 0)                                                                                            \
+                samples[round] = perCall;                                                                              \
+        }                                                                                                              \
+        mean = report(kernel, build, samples, c);                                                                      \
+    } while (0)
+
+// Runs the C and the Kopi version of a kernel, after checking that they agree
+#define BENCH(kernel, build, ...)                                                                                      \
+    do {                                                                                                               \
+        for (int i = 0; i < 1000; i++) {                                                                               \
+            if (kernel(__VA_ARGS__) != c_##kernel(__VA_ARGS__)) {                                                      \
+                printf("%s: Kopi and C results differ at i = %d\n", #kernel, i);                                       \
+                return 1;                                                                                              \
+            }                                                                                                          \
+        }                                                                                                              \
+        double c, kopi;                                                                                                \
+        MEASURE(c, #kernel, "C -O2", 0, c_##kernel(__VA_ARGS__));                                                      \
+        MEASURE(kopi, #kernel, build, c, kernel(__VA_ARGS__));                                                         \
+        (void)kopi;                                                                                                    \
+    } while (0)
+
+int main(int argc, char *argv[]) {
+    const char *build = argc > 1 ? argv[1] : "kopic";
+
+    BENCH(poly, build, (i & 15) - 8);
+    BENCH(dist2, build, i & 1023, (i >> 3) & 1023, 17, -5);
+    BENCH(scale, build, i & 0xffff, 3 + (i & 7), 1 + (i & 15));
+    BENCH(sumSquares, build, i & 255, (i >> 8) & 255, 100);
+
+    return 0;
+}
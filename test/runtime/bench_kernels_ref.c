@@ -0,0 +1,23 @@
+// C versions of the kernels in bench_kernels.kopi
+
+int c_poly(int x) {
+    return ((((((3 * x + 7) * x - 2) * x + 11) * x - 5) * x + 13) * x - 1) * x + 9;
+}
+
+int c_dist2(int x1, int y1, int x2, int y2) {
+    int dx = x2 - x1;
+    int dy = y2 - y1;
+    return dx * dx + dy * dy;
+}
+
+int c_scale(int value, int num, int den) {
+    return value * num / den + value / 3 - value / 7;
+}
+
+static int square(int x) {
+    return x * x;
+}
+
+int c_sumSquares(int a, int b, int c) {
+    return square(a) + square(b) + square(c) - square(a - b);
+}
@@ -0,0 +1,14 @@
+// Training run for pgo.kopi, which makes hotPath hot and coldPath cold
+#include <stdio.h>
+
+extern int hotPath(int);
+extern int coldPath(int);
+
+int main() {
+    int acc = coldPath(1);
+    for (int i = 0; i < 1000000; i++) {
+        acc += hotPath(i & 1023);
+    }
+    printf("%d\n", acc);
+    return 0;
+}
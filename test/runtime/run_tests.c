@@ -12,16 +12,49 @@ void expectEq(const char *name, int result, int expected) {
 
 int main() {
     extern int testArithmetic(void);
+    extern int nestedUnary(int, int);
+    extern int stackedUnary(int);
+    extern int minLiteral(int);
+    extern int foldedMinDivide(void);
     extern int noParams(void);
     extern int withParams(int, int);
     extern int callAnother(int);
+    extern int callHelpers(int);
+    extern int folded(void);
+    extern int constantCall(void);
     extern int testVars(int);
+    extern int testScopes(int);
+    extern int bumpParam(int);
+    extern int sign(int);
+    extern int sumTo(int);
+    extern int collatz(int);
+    extern int hintedLoops(int);
+    extern int countDown(int, int);
+    extern int longChain(int);
+    extern int longChainFolded(void);
 
     expectEq("testArithmetic", testArithmetic(), 21);
+    expectEq("nestedUnary", nestedUnary(3, 20), 7);
+    expectEq("stackedUnary", stackedUnary(5), 45);
+    expectEq("minLiteral", minLiteral(-1), -2147483647 - 1);
+    expectEq("minLiteral", minLiteral(7), -306783378);
+    expectEq("foldedMinDivide", foldedMinDivide(), -2147483647 - 1);
     expectEq("noParams", noParams(), 997);
     expectEq("withParams", withParams(2, 3), 13);
     expectEq("callAnother", callAnother(6), 945);
+    expectEq("callHelpers", callHelpers(3), 16);
+    expectEq("folded", folded(), 53);
+    expectEq("constantCall", constantCall(), 11);
     expectEq("testVars", testVars(4), -10);
+    expectEq("testScopes", testScopes(3), 308);
+    expectEq("bumpParam", bumpParam(5), 11);
+    expectEq("sign", sign(-5) * 100 + sign(0) * 10 + sign(7), -99);
+    expectEq("sumTo", sumTo(100), 5050);
+    expectEq("collatz", collatz(27), 111);
+    expectEq("hintedLoops", hintedLoops(10), 2);
+    expectEq("countDown", countDown(100000000, 0), 100000000);
+    expectEq("longChain", longChain(3), 300000);
+    expectEq("longChainFolded", longChainFolded(), 200003);
 
     return 0;
 }